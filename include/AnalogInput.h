@@ -0,0 +1,48 @@
+#ifndef ANALOG_INPUT_H
+#define ANALOG_INPUT_H
+
+#include <stdint.h>
+
+// ----------------------------- CV inputs (ADC through DMA)
+// Each input has one of the two ADCs to itself, converting continuously off
+// its timer at ANALOG_SAMPLE_HZ. DMA fills one half of a double buffer while
+// the loop reduces the other: ANALOG_BLOCK 12 bit samples (1 ms) averaged
+// into one 16 bit value, which the control tick reads with a single load
+// instead of waiting out an analogRead(). Averaging 64 samples takes the
+// noise down by 8, 3 bits. The same sums give every block's variance, the
+// noise around the block mean, which holds while the input barely moves
+// within a millisecond.
+// rate() is the sample rate actually processed, blocks the loop did not get
+// to before DMA reused the buffer do not count. A gap over ANALOG_GAP_US is
+// the converter stopped (idle), not blocks lost, and is left out.
+
+#define ANALOG_CHANNELS 1
+#define ANALOG_LFO_CV 0                // channel of the external LFO input
+#define ANALOG_SAMPLE_HZ 64000
+#define ANALOG_BLOCK 64                // samples per half buffer
+#define ANALOG_BLOCK_SHIFT 6
+#define ANALOG_ADC_BITS 12
+#define ANALOG_MID 32768               // value[] of half scale
+#define ANALOG_GAP_US 20000
+
+struct AnalogInput {
+  volatile uint16_t value[ANALOG_CHANNELS];   // latest block mean, 16 bit
+  uint32_t blocks[ANALOG_CHANNELS];
+  uint64_t noiseSum[ANALOG_CHANNELS];         // sum of block variance * ANALOG_BLOCK
+  uint16_t lowest[ANALOG_CHANNELS];           // range of value[] seen
+  uint16_t highest[ANALOG_CHANNELS];
+  uint32_t lastBlockAt[ANALOG_CHANNELS];      // µs
+  uint32_t timedBlocks[ANALOG_CHANNELS];      // blocks that end a timed gap
+  uint64_t timedUs[ANALOG_CHANNELS];
+
+  void begin();
+  // One filled half buffer of a channel
+  void block(uint8_t channel, const volatile uint16_t* samples, uint32_t now);
+  uint16_t read(uint8_t channel) const { return value[channel]; }
+  // Samples per second processed, 0 before two blocks in a row
+  uint32_t rate(uint8_t channel) const;
+  // RMS noise of the raw samples in 1/100 ADC LSB
+  uint32_t noiseCentiLsb(uint8_t channel) const;
+};
+
+#endif
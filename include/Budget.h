@@ -0,0 +1,46 @@
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include <stdint.h>
+
+// ----------------------------- Cycle budget monitor
+// Records how long loop() passes and control ticks take (CPU cycles from the
+// DWT counter) into a histogram for worst case and percentiles. Buckets are
+// a power of two cycles wide so recording is a shift and an increment.
+
+#define BUDGET_BUCKETS 64
+
+struct BudgetMonitor {
+  uint32_t budget;            // cycles
+  uint8_t bucketShift;        // bucket width = 1 << bucketShift cycles
+  uint32_t count;
+  uint32_t worst;
+  uint32_t overruns;
+  uint32_t histogram[BUDGET_BUCKETS];
+
+  void begin(uint32_t budgetCycles, uint8_t shift);
+  // True when the duration went over budget
+  bool record(uint32_t cycles);
+  // Upper edge of the bucket holding the given share, in cycles
+  uint32_t percentile(uint16_t permille) const;
+};
+
+// ----------------------------- Adaptive degradation
+// Any overrun raises the level at once; it only drops again after
+// DEGRADE_RECOVER_TICKS clean control ticks in a row.
+//   1: LFO recomputed every other tick, panel reads and SysEx dumps wait
+//   2: LFO frozen at its last value as well
+
+#define DEGRADE_MAX 2
+#define DEGRADE_RECOVER_TICKS 1000
+
+struct Degrader {
+  uint8_t level;
+  uint16_t cleanTicks;
+
+  void begin() { level = 0; cleanTicks = 0; }
+  // Returns true when the level changed
+  bool update(bool overrun);
+};
+
+#endif
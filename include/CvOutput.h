@@ -0,0 +1,436 @@
+#ifndef CV_OUTPUT_H
+#define CV_OUTPUT_H
+
+#include <stdint.h>
+#include "I2cBus.h"
+#include "VoiceEngine.h"
+
+// ----------------------------- Output backends
+// One compile-time interface for every output chip. A backend derives from
+// CvOutput<itself> and supplies beginFrame(now), writeVoice(voice, v) and
+// endFrame(now); frame() walks the voices and calls them directly, so the
+// whole per-voice path inlines and there is no virtual call or function
+// pointer anywhere in it. Each backend has its own begin() since the chips
+// need different pins and setup. begin() does not wait for any chip:
+// bringUp(now) is called from the loop until every voice is ready or
+// absent, it moves the chip setup along a step at a time and returns the
+// voices whose output is ready; absentVoices() those whose hardware was
+// given up on, failedWrites() the writes the hardware did not take. Frames
+// skip chips that are not ready. Every backend numbers its
+// frames in cvFrames, newestFrame() and frameWritten() read them.
+// Backends that talk to SPI hardware live in SpiOutput.h (device only).
+
+// ----------------------------- Frame numbers and write-out times
+// endFrame() numbers each frame, and the backend notes when the frame has
+// been written out in full: right away for blocking SPI, otherwise from the
+// DMA or bus interrupt. A frame that was skipped or had nothing to write
+// goes out with the next one that finishes. The gate output measures its
+// skew from these times. Only the last CV_FRAME_HISTORY are kept.
+#define CV_FRAME_HISTORY 8             // power of two
+
+struct CvFrames {
+  volatile uint32_t started;           // newest frame number
+  volatile uint32_t written;           // newest frame written out in full
+  volatile uint32_t writtenAt[CV_FRAME_HISTORY];
+
+  void begin() {
+    started = 0;
+    written = 0;
+    writtenAt[0] = 0;
+  }
+
+  uint32_t start() { return ++started; }
+
+  // Every frame up to frame is out. Both the loop and an interrupt may call
+  // this, neither goes past started.
+  void done(uint32_t frame, uint32_t now) {
+    uint32_t w = written;
+    while ((int32_t)(frame - w) > 0) {
+      w++;
+      writtenAt[w & (CV_FRAME_HISTORY - 1)] = now;
+    }
+    if ((int32_t)(w - written) > 0) {
+      written = w;
+    }
+  }
+
+  // False while the frame is still going out. For a frame older than the
+  // history this gives the oldest time kept, it was out by then.
+  bool writtenTime(uint32_t frame, uint32_t& at) const {
+    uint32_t w = written;
+    if ((int32_t)(frame - w) > 0) {
+      return false;
+    }
+    if (w - frame >= CV_FRAME_HISTORY) {
+      frame = w - (CV_FRAME_HISTORY - 1);
+    }
+    at = writtenAt[frame & (CV_FRAME_HISTORY - 1)];
+    return true;
+  }
+};
+
+template <class Backend>
+struct CvOutput {
+  void frame(const Voice* voices, uint8_t count, uint32_t now) {
+    Backend& backend = static_cast<Backend&>(*this);
+    backend.beginFrame(now);
+    for (uint8_t i = 0; i < count; i++) {
+      backend.writeVoice(i, voices[i]);
+    }
+    backend.endFrame(now);
+  }
+
+  uint32_t absentVoices() const {
+    return 0;
+  }
+
+  uint32_t failedWrites() const {
+    return 0;
+  }
+
+  uint32_t newestFrame() const {
+    return static_cast<const Backend&>(*this).cvFrames.started;
+  }
+
+  bool frameWritten(uint32_t frame, uint32_t& at) const {
+    return static_cast<const Backend&>(*this).cvFrames.writtenTime(frame, at);
+  }
+};
+
+// ----------------------------- AD9833 frequency word
+// 28 bit FREQ0 for a frequency, shared by the DDS backend and telemetry
+#define AD9833_MCLK 25000000.0
+
+inline uint32_t ad9833Word(float frequency) {
+  return (uint32_t)(frequency * (float)(268435456.0 / AD9833_MCLK));
+}
+
+// ----------------------------- MCP4728 banks, 4 channels each, through the I2C queue
+// A bank is one MCP4728: its TCA9548 channel and its address, so several
+// (with programmed addresses) can share a mux channel; list those next to
+// each other, the bus only selects the mux when the channel changes.
+// Fast write (PD = 00) of all four channels, and only for a bank where one
+// of the codes changed since its last write; a write the bank did not
+// acknowledge forgets its codes, so the next frame sends them again. A bank counts
+// as ready once a write of all-zero codes was acknowledged; one that does
+// not answer is tried again every MCP4728_RETRY_US, MCP4728_PROBES times in
+// all, then counted absent so startup can complete without it.
+// MCP4728_BANK_US is the bus time of one bank update with its mux select,
+// the firmware checks its banks fit into a control tick. A frame is written
+// once the bus has finished every CV write queued up to it.
+#define MCP4728_ADDRESS 0x60
+#define MCP4728_CHANNELS 4
+#define MCP4728_RETRY_US 50000
+#define MCP4728_PROBES 20                  // 1 s of retries
+#define MCP4728_BANK_US ((11 * 9 + 4) * 1000000 / I2C_CLOCK + 1)
+
+struct Mcp4728Bank {
+  uint8_t muxChannel;              // I2C_NO_MUX if upstream of the mux
+  uint8_t address;
+};
+
+template <uint8_t DACS>
+struct Mcp4728Output : CvOutput<Mcp4728Output<DACS> > {
+  static_assert(DACS * MCP4728_CHANNELS <= 32, "ready masks are 32 bit");
+  static_assert(DACS <= I2C_QUEUE_SIZE, "a frame must fit the CV queue");
+  const Mcp4728Bank* bank;
+  uint16_t code[DACS * MCP4728_CHANNELS];
+  uint8_t bytes[DACS][MCP4728_CHANNELS * 2];
+  bool changed[DACS];
+  uint32_t ready;                  // bit per DAC
+  volatile uint32_t probing;       // bit per DAC, write in flight
+  volatile uint32_t answered;      // set from the I2C interrupt
+  uint32_t probeAt[DACS];
+  uint8_t probes[DACS];            // sent so far
+  uint32_t absent;                 // bit per DAC, never answered
+  CvFrames cvFrames;
+  uint32_t writesQueued;           // CV writes the bus took
+  volatile uint32_t writesDone;    // and finished, from the I2C interrupt
+  volatile uint32_t writesFailed;  // of those, not acknowledged
+  uint32_t frameWrites[CV_FRAME_HISTORY];  // writesQueued after each frame
+  static Mcp4728Output* instance;
+
+  void begin(const Mcp4728Bank* banks) {
+    instance = this;
+    bank = banks;
+    cvFrames.begin();
+    writesQueued = 0;
+    writesDone = 0;
+    writesFailed = 0;
+    for (int i = 0; i < DACS * MCP4728_CHANNELS; i++) {
+      code[i] = 0xFFFF;
+    }
+    for (int dac = 0; dac < DACS; dac++) {
+      probeAt[dac] = 0;                                  // at the first bringUp()
+      probes[dac] = 0;
+    }
+    ready = 0;
+    absent = 0;
+    probing = 0;
+    answered = 0;
+  }
+
+  static void probeComplete(const I2cTransaction& transaction, bool ok) {
+    for (int dac = 0; dac < DACS; dac++) {
+      const Mcp4728Bank& b = instance->bank[dac];
+      if (b.muxChannel == transaction.muxChannel && b.address == transaction.address) {
+        if (ok) {
+          instance->answered |= 1u << dac;
+        }
+        instance->probing &= ~(1u << dac);
+      }
+    }
+  }
+
+  // The codes of this bank, 0xFFFF when unknown
+  void setCodes(uint8_t dac, bool known) {
+    for (int channel = 0; channel < MCP4728_CHANNELS; channel++) {
+      code[dac * MCP4728_CHANNELS + channel] = known ? (uint16_t)(bytes[dac][channel * 2] << 8 | bytes[dac][channel * 2 + 1]) : 0xFFFF;
+    }
+  }
+
+  static void writeComplete(const I2cTransaction& transaction, bool ok) {
+    Mcp4728Output& output = *instance;
+    if (!ok) {
+      output.writesFailed++;
+      for (int dac = 0; dac < DACS; dac++) {
+        const Mcp4728Bank& b = output.bank[dac];
+        if (b.muxChannel == transaction.muxChannel && b.address == transaction.address) {
+          output.setCodes(dac, false);
+        }
+      }
+    }
+    uint32_t done = ++output.writesDone;
+    uint32_t frame = output.cvFrames.written;
+    while (frame != output.cvFrames.started && (int32_t)(output.frameWrites[(frame + 1) & (CV_FRAME_HISTORY - 1)] - done) <= 0) {
+      frame++;
+    }
+    output.cvFrames.done(frame, i2cBus.completedAt);
+  }
+
+  uint32_t bringUp(uint32_t now) {
+    ready |= answered;
+    uint32_t voices = 0;
+    for (int dac = 0; dac < DACS; dac++) {
+      uint32_t bit = 1u << dac;
+      if (ready & bit) {
+        voices |= ((1u << MCP4728_CHANNELS) - 1) << (dac * MCP4728_CHANNELS);
+      } else if (!(absent & bit) && !(probing & bit) && (int32_t)(now - probeAt[dac]) >= 0) {
+        if (probes[dac] >= MCP4728_PROBES) {
+          absent |= bit;
+          continue;
+        }
+        const uint8_t zero[MCP4728_CHANNELS * 2] = { 0 };
+        probing |= bit;
+        if (i2cBus.write(I2C_PRIORITY_CV, bank[dac].muxChannel, bank[dac].address, zero, sizeof(zero), probeComplete)) {
+          probeAt[dac] = now + MCP4728_RETRY_US;
+          probes[dac]++;
+        } else {
+          probing &= ~bit;
+        }
+      }
+    }
+    return voices;
+  }
+
+  uint32_t failedWrites() const {
+    return writesFailed;
+  }
+
+  uint32_t absentVoices() const {
+    uint32_t voices = 0;
+    for (int dac = 0; dac < DACS; dac++) {
+      if (absent & (1u << dac)) {
+        voices |= ((1u << MCP4728_CHANNELS) - 1) << (dac * MCP4728_CHANNELS);
+      }
+    }
+    return voices;
+  }
+
+  void beginFrame(uint32_t now) {
+    (void)now;
+    for (int dac = 0; dac < DACS; dac++) {
+      changed[dac] = false;
+    }
+  }
+
+  void writeVoice(uint8_t voice, const Voice& v) {
+    uint8_t dac = voice / MCP4728_CHANNELS;
+    uint8_t channel = voice % MCP4728_CHANNELS;
+    uint16_t dacCode = v.bentNoteVolts >> 2;             // 14 bit CV to 12 bit DAC
+    bytes[dac][channel * 2] = (dacCode >> 8) & 0x0F;
+    bytes[dac][channel * 2 + 1] = dacCode & 0xFF;
+    if (dacCode != code[voice]) {
+      changed[dac] = true;
+    }
+  }
+
+  void endFrame(uint32_t now) {
+    uint32_t frame = cvFrames.started + 1;
+    for (int dac = 0; dac < DACS; dac++) {
+      if (!changed[dac] || !(ready & (1u << dac))) {
+        continue;
+      }
+      // Before queueing, so a failure from the interrupt is not overwritten
+      setCodes(dac, true);
+      if (i2cBus.write(I2C_PRIORITY_CV, bank[dac].muxChannel, bank[dac].address, bytes[dac], MCP4728_CHANNELS * 2, writeComplete)) {
+        writesQueued++;
+      } else {
+        setCodes(dac, false);
+      }
+    }
+    // The interrupt only looks at frames up to started
+    frameWrites[frame & (CV_FRAME_HISTORY - 1)] = writesQueued;
+    cvFrames.started = frame;
+    if (writesDone == writesQueued) {
+      cvFrames.done(frame, now);
+    }
+  }
+};
+
+template <uint8_t DACS>
+Mcp4728Output<DACS>* Mcp4728Output<DACS>::instance;
+
+// ----------------------------- Routing table over two backends
+// Voices reach their DAC channel through a table, so one engine spans
+// MCP4728 banks behind the TCA9548 and SPI DACs, in any order. A route
+// names the backend and the channel within it, counted across its chips
+// (MCP4728: bank * 4 + channel, SPI DAC: chip * 8 + channel). Both backends
+// see every frame and write only what changed; the backends are begun by
+// the caller, with their own pins and banks.
+#define ROUTE_FIRST 0
+#define ROUTE_SECOND 1
+
+struct CvRoute {
+  uint8_t output;                  // ROUTE_*
+  uint8_t channel;
+};
+
+template <class First, class Second, uint8_t VOICES>
+struct RoutedOutput : CvOutput<RoutedOutput<First, Second, VOICES> > {
+  typedef typename VoiceBits<(VOICES > 32)>::Mask Mask;
+  First first;
+  Second second;
+  const CvRoute* route;
+
+  void begin(const CvRoute* routes) {
+    route = routes;
+  }
+
+  // Voices whose channel is ready on its backend
+  Mask bringUp(uint32_t now) {
+    uint32_t ready[2] = { first.bringUp(now), second.bringUp(now) };
+    Mask voices = 0;
+    for (int i = 0; i < VOICES; i++) {
+      if (ready[route[i].output] >> route[i].channel & 1) {
+        voices |= (Mask)1 << i;
+      }
+    }
+    return voices;
+  }
+
+  uint32_t failedWrites() const {
+    return first.failedWrites() + second.failedWrites();
+  }
+
+  Mask absentVoices() const {
+    uint32_t absent[2] = { first.absentVoices(), second.absentVoices() };
+    Mask voices = 0;
+    for (int i = 0; i < VOICES; i++) {
+      if (absent[route[i].output] >> route[i].channel & 1) {
+        voices |= (Mask)1 << i;
+      }
+    }
+    return voices;
+  }
+
+  void beginFrame(uint32_t now) {
+    first.beginFrame(now);
+    second.beginFrame(now);
+  }
+
+  void writeVoice(uint8_t voice, const Voice& v) {
+    const CvRoute& r = route[voice];
+    if (r.output == ROUTE_FIRST) {
+      first.writeVoice(r.channel, v);
+    } else {
+      second.writeVoice(r.channel, v);
+    }
+  }
+
+  void endFrame(uint32_t now) {
+    first.endFrame(now);
+    second.endFrame(now);
+  }
+
+  // Both backends number every frame, a frame is out once it is on both
+  uint32_t newestFrame() const {
+    return first.newestFrame();
+  }
+
+  bool frameWritten(uint32_t frame, uint32_t& at) const {
+    uint32_t firstAt;
+    uint32_t secondAt;
+    if (!first.frameWritten(frame, firstAt) || !second.frameWritten(frame, secondAt)) {
+      return false;
+    }
+    at = (int32_t)(firstAt - secondAt) > 0 ? firstAt : secondAt;
+    return true;
+  }
+};
+
+// ----------------------------- Recording simulator
+// Keeps every voice write with its frame time, for host tests and benchmarks.
+// Writes past CAPACITY are counted, not stored.
+struct SimWrite {
+  uint32_t time;
+  uint8_t voice;
+  uint16_t volts;
+  float frequency;
+};
+
+template <uint32_t CAPACITY>
+struct SimOutput : CvOutput<SimOutput<CAPACITY> > {
+  SimWrite writes[CAPACITY];
+  uint32_t count;
+  uint32_t dropped;
+  uint32_t frames;
+  uint32_t frameTime;
+  CvFrames cvFrames;
+
+  void begin() {
+    count = 0;
+    dropped = 0;
+    frames = 0;
+    frameTime = 0;
+    cvFrames.begin();
+  }
+
+  uint32_t bringUp(uint32_t now) {
+    (void)now;
+    return 0xFFFFFFFF;
+  }
+
+  void beginFrame(uint32_t now) {
+    frameTime = now;
+    frames++;
+  }
+
+  void writeVoice(uint8_t voice, const Voice& v) {
+    if (count >= CAPACITY) {
+      dropped++;
+      return;
+    }
+    SimWrite& write = writes[count++];
+    write.time = frameTime;
+    write.voice = voice;
+    write.volts = v.bentNoteVolts;
+    write.frequency = v.bentFrequency;
+  }
+
+  void endFrame(uint32_t now) {
+    cvFrames.done(cvFrames.start(), now);
+  }
+};
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef EVENT_QUEUE_H
+#define EVENT_QUEUE_H
+
+#include <stdint.h>
+
+// ----------------------------- Timestamped input events
+// Every input source (DIN, USB, panel) timestamps its messages as close to
+// arrival as it can tell and pushes them here. A DIN message is read a loop
+// pass or more after its last byte came in, the bytes buffered behind it
+// came in later, one per MIDI_DIN_BYTE_US, so its stamp is moved back by
+// those. USB delivers whole packets and is stamped when read. The queue
+// keeps events in time order, so the engine sees one merged stream no matter
+// which port a note came in on: a DIN event read late sorts in ahead of USB
+// events still waiting for their scheduled output. Insertion walks back from
+// the tail, which is O(1) for the usual in-order arrival.
+
+#define EVENT_SOURCE_DIN 0
+#define EVENT_SOURCE_USB 1
+#define EVENT_SOURCE_PANEL 2
+#define NUM_EVENT_SOURCES 3
+
+// Channel voice status bytes as they appear in MidiEvent::type
+#define EVENT_TYPE_NOTE_OFF 0x80
+#define EVENT_TYPE_NOTE_ON 0x90
+#define EVENT_TYPE_POLY_PRESSURE 0xA0
+#define EVENT_TYPE_CONTROL_CHANGE 0xB0
+#define EVENT_TYPE_PROGRAM_CHANGE 0xC0
+#define EVENT_TYPE_CHANNEL_PRESSURE 0xD0
+#define EVENT_TYPE_PITCH_BEND 0xE0
+
+// Front panel input change: data1 = input number, data2 = 1 pressed / 0 released
+// (0xF4 is an undefined MIDI status, so it can never come in over a port)
+#define EVENT_TYPE_PANEL 0xF4
+
+#define EVENT_QUEUE_SIZE 64   // power of two
+#define MIDI_DIN_BYTE_US 320  // 10 bits at 31250 baud
+
+// Type filter bits, one per channel voice message (status >> 4) & 7. System
+// messages (SysEx, clock, start/stop) all share bit 7.
+#define EVENT_TYPE_BIT(type) (1u << (((type) >> 4) & 7))
+#define EVENT_TYPES_ALL 0xFFu
+
+struct MidiEvent {
+  uint32_t time;      // micros() at arrival, see dinArrival()
+  uint8_t source;
+  uint8_t type;       // status byte without channel (0x80..0xE0) or EVENT_TYPE_PANEL
+  uint8_t channel;    // 1..16
+  uint8_t data1;
+  uint8_t data2;
+};
+
+// Arrival of a DIN message read at now with bytesBehind bytes still buffered
+inline uint32_t dinArrival(uint32_t now, uint32_t bytesBehind) {
+  return now - bytesBehind * MIDI_DIN_BYTE_US;
+}
+
+struct EventSource {
+  uint16_t channelMask;   // bit n = accept channel n + 1
+  uint8_t typeMask;       // EVENT_TYPE_BIT() of accepted types
+  uint32_t received;
+  uint32_t filtered;
+  uint32_t overflows;
+  uint32_t dispatched;
+  uint32_t latencySum;    // ingest to dispatch, µs
+  uint32_t latencyMax;
+};
+
+struct EventQueue {
+  MidiEvent events[EVENT_QUEUE_SIZE];
+  uint8_t head;
+  uint8_t count;
+  EventSource sources[NUM_EVENT_SOURCES];
+
+  void begin();
+  void setFilter(uint8_t source, uint16_t channelMask, uint8_t typeMask);
+  // Applies the source filter and counts the message; system messages that
+  // are handled at ingest instead of queued go through this too
+  bool accepts(uint8_t source, uint8_t type, uint8_t channel);
+  // False if the event was filtered out or the queue is full
+  bool push(const MidiEvent& event);
+  bool empty() const { return count == 0; }
+  const MidiEvent& front() const { return events[head]; }
+  // Removes the front event and books its latency against its source
+  void pop(uint32_t now);
+  uint32_t averageLatency(uint8_t source) const;
+};
+
+#endif
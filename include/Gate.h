@@ -0,0 +1,57 @@
+#ifndef GATE_H
+#define GATE_H
+
+#include <stdint.h>
+#include "Budget.h"
+#include "I2cBus.h"
+#include "VoiceEngine.h"
+
+// ----------------------------- Gate outputs (one MCP23017, bit per voice)
+// The engine keeps its gates as a bitmask; once per control tick the whole
+// mask goes to the expander's output latches in a single register write, and
+// only when it changed. A gate opens one tick after its voice's new pitch
+// was first rendered, so the CV has been written (and the DAC settled) by
+// then: on the MCP4728 backend the CV frame also went out at a higher bus
+// priority. A new note on a voice whose gate is already open (steal, fast
+// legato, repeated key) pulls the gate low for GATE_RETRIGGER_TICKS first.
+// skew holds the time from the CV frame carrying the pitch being written out
+// (as the output backend reports it) to the gate write finishing on the
+// bus. Openings that beat that frame, or follow it by less than
+// GATE_SETTLE_US, are counted as early; skew.overruns counts those later
+// than GATE_LATE_US.
+
+#define GATE_MCP_ADDRESS 0x21
+#define MCP23017_IODIRA 0x00
+#define MCP23017_OLATA 0x14
+#define GATE_RETRIGGER_TICKS 2
+#define GATE_SETTLE_US 20              // DAC settling plus margin
+#define GATE_LATE_US 2000
+#define GATE_SKEW_BUCKET_SHIFT 5       // 32 µs buckets
+
+struct GateOutput {
+  uint32_t seen;                       // engine gates at the last tick
+  uint32_t port;                       // last value the expander took
+  uint32_t pendingPort;                // value of the write in flight
+  volatile bool busy;
+  uint8_t noteCount[NUM_VOICES];       // last note seen on each voice
+  uint8_t pulse[NUM_VOICES];           // retrigger ticks left
+  uint32_t pitchFrame[NUM_VOICES];     // CV frame carrying the voice's pitch
+  bool opening;                        // the write in flight opens a gate
+  uint32_t openingFrame;               // newest pitch frame among those
+  BudgetMonitor skew;                  // pitch written to gate open, µs
+  uint32_t early;
+  uint32_t writes;
+  uint32_t failed;
+  uint32_t retriggers;
+
+  // Sets both ports to outputs, all gates closed (queued, call after
+  // i2cBus.begin())
+  void begin();
+  // Once per tick after the CV frame, with the newest frame's number; done
+  // must hand the bus result to complete() with the current time and when
+  // openingFrame was written out (pitchWritten false while it is not)
+  void update(const Voice* voices, uint32_t gates, uint32_t cvFrame, I2cCallback done);
+  void complete(bool ok, uint32_t now, bool pitchWritten, uint32_t pitchWrittenAt);
+};
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef I2C_BUS_H
+#define I2C_BUS_H
+
+#include <stdint.h>
+
+// ----------------------------- Asynchronous I2C transaction scheduler
+// All devices on Wire (MCP4728 DACs, MCP23017 expanders, TCA9548 mux) go
+// through this queue instead of Wire's blocking calls. Callers enqueue and
+// return at once; the LPI2C interrupt feeds the hardware FIFO and starts the
+// next transaction when one finishes. Each priority level has its own ring,
+// and the highest non-empty level always goes next, so CV updates overtake
+// panel reads that were queued earlier. The mux is tracked: a TCA9548 select
+// is only sent when a transaction needs a different channel than the last.
+
+#define I2C_PRIORITY_CV 0
+#define I2C_PRIORITY_GATE 1
+#define I2C_PRIORITY_PANEL 2
+#define I2C_PRIORITIES 3
+
+#define I2C_QUEUE_SIZE 16      // per priority, power of two
+#define I2C_MAX_WRITE 10
+#define I2C_NO_MUX 0xFF        // device sits upstream of the mux
+#define I2C_MUX_ADDRESS 0x70
+#define I2C_CLOCK 400000
+
+struct I2cTransaction;
+typedef void (*I2cCallback)(const I2cTransaction& transaction, bool ok);
+
+struct I2cTransaction {
+  uint8_t address;
+  uint8_t muxChannel;
+  uint8_t writeLength;
+  uint8_t readLength;          // read after a repeated start, 0 = write only
+  uint8_t data[I2C_MAX_WRITE];
+  uint8_t* readBuffer;
+  I2cCallback done;            // runs in interrupt context, may be 0
+  uint32_t queuedAt;
+};
+
+struct I2cStats {
+  uint32_t completed;
+  uint32_t failed;
+  uint32_t dropped;            // queue full at enqueue
+  uint32_t muxSelects;
+  uint32_t muxSkipped;         // selects saved because the channel matched
+  uint32_t waitSum[I2C_PRIORITIES];  // queue latency, µs
+  uint32_t waitMax[I2C_PRIORITIES];
+  uint32_t waitCount[I2C_PRIORITIES];
+  uint32_t busyTime;           // µs the bus spent transferring
+  uint32_t windowStart;
+  uint16_t utilization;        // busy share of the last window, 1/10 %
+};
+
+struct I2cBus {
+  I2cTransaction queue[I2C_PRIORITIES][I2C_QUEUE_SIZE];
+  volatile uint8_t head[I2C_PRIORITIES];
+  volatile uint8_t tail[I2C_PRIORITIES];
+  I2cTransaction* active;
+  volatile bool busy;
+  bool erroring;               // failed, waiting for its STOP before the next
+  uint8_t muxChannel;          // currently selected, I2C_NO_MUX = unknown
+  uint32_t startedAt;
+  uint32_t completedAt;        // micros() the last transaction ended, for its callback
+  I2cStats stats;
+
+  // Hardware command stream of the active transaction
+  uint16_t commands[I2C_MAX_WRITE + 10];
+  uint8_t commandCount;
+  uint8_t commandIndex;
+  uint8_t readIndex;
+
+  void begin();
+  // Copies the transaction into the queue; false if that priority is full
+  bool enqueue(uint8_t priority, const I2cTransaction& transaction);
+  // false as well for more than I2C_MAX_WRITE bytes
+  bool write(uint8_t priority, uint8_t muxChannel, uint8_t address, const uint8_t* bytes, uint8_t length, I2cCallback done = 0);
+  bool readRegister(uint8_t priority, uint8_t muxChannel, uint8_t address, uint8_t reg, uint8_t* buffer, uint8_t length, I2cCallback done = 0);
+  uint8_t pending(uint8_t priority) const { return (uint8_t)(tail[priority] - head[priority]); }
+  bool idle() const { return !busy; }
+  uint32_t averageWait(uint8_t priority) const;
+  // Rolls the utilization window, call about once a second
+  void updateStats(uint32_t now);
+
+  // Driver side
+  void startNext();
+  void buildCommands();
+  void complete(bool ok);
+  void service();              // LPI2C interrupt body
+};
+
+extern I2cBus i2cBus;
+
+#endif
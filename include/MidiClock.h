@@ -0,0 +1,68 @@
+#ifndef MIDI_CLOCK_H
+#define MIDI_CLOCK_H
+
+#include <stdint.h>
+
+// ----------------------------- MIDI clock (24 PPQN) tracking
+// Incoming 0xF8 ticks are timestamped where they are read and fed through a
+// second order delay-locked loop. tick() is integer arithmetic with a
+// single divide (the phase rate), so it costs the same for every tick and is
+// safe to call from the ingest path. Times are micros() values; all comparisons are done modulo
+// 2^32 so micros() wrap-around is harmless.
+
+#define MIDI_CLOCK_PPQN 24
+#define MIDI_CLOCK_MIN_PERIOD 8333     // 300 BPM, in µs per tick
+#define MIDI_CLOCK_MAX_PERIOD 125000   // 20 BPM
+#define MIDI_CLOCK_DEFAULT_PERIOD 20833 // 120 BPM
+
+// Loop gains as right shifts: b = 1/8, c = 1/128 (b^2 = 2c, critically damped)
+#define MIDI_CLOCK_GAIN_B 3
+#define MIDI_CLOCK_GAIN_C 7
+// Faster b = 1/2, c = 1/8 for the first ticks after (re)acquiring
+#define MIDI_CLOCK_ACQUIRE_GAIN_B 1
+#define MIDI_CLOCK_ACQUIRE_GAIN_C 3
+#define MIDI_CLOCK_ACQUIRE_TICKS 24
+
+// Ticks within this many µs of the prediction are tracked, anything further
+// off (tempo jump, dropout) re-seeds the loop from the raw interval
+#define MIDI_CLOCK_CAPTURE_US 4000
+
+// No tick for this many periods: the master is gone, drop the lock so the
+// player falls back to its internal tempo
+#define MIDI_CLOCK_TIMEOUT_TICKS 8
+
+// 2^32 / 24 rounded down, so the last tick of a beat ends below 2^32
+#define MIDI_CLOCK_PHASE_PER_TICK 178956970u
+
+struct MidiClock {
+  bool running;
+  bool locked;
+  bool startPending;
+  uint8_t acquireTicks;        // ticks left on the wide acquisition gains
+  uint8_t tickInBeat;          // 0..23
+  uint32_t beatCount;          // quarter notes since Start
+  uint32_t lastRawTick;        // micros() of the previous 0xF8
+  uint32_t tickTimeQ8;         // filtered time of the last tick, µs << 8
+  uint32_t periodQ8;           // filtered tick period, µs << 8
+  uint32_t phasePerUs;         // quarter-note phase advance per µs
+  int32_t lastErrorQ8;         // prediction error of the last tick, µs << 8
+  uint32_t ticksReceived;
+  uint32_t reseeds;
+
+  void reset();
+  void tick(uint32_t now);
+  void start(uint32_t now);
+  void cont(uint32_t now);
+  void stop();
+  // From the control tick: clears locked and running once ticks stop
+  void poll(uint32_t now);
+
+  // Quarter-note phase (full uint32 range = one beat) at time now. Holds at
+  // the next tick boundary if ticks stop arriving, never runs ahead of it.
+  uint32_t phase(uint32_t now) const;
+  // Tempo in 1/100 BPM
+  uint16_t tempo() const;
+  uint32_t tickPeriod() const { return periodQ8 >> 8; }
+};
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef PANEL_H
+#define PANEL_H
+
+#include <stdint.h>
+#include "EventQueue.h"
+
+// ----------------------------- Front panel inputs (one MCP23017, 16 inputs)
+// The expander's INTA/INTB lines tell us when a pin changed, so the ports are
+// only read then. Debouncing follows Bounce2's stable-interval rule: an input
+// is committed once it has not moved for PANEL_DEBOUNCE_US. All 16 inputs are
+// handled as one bitmask; only bits that are actually in flux cost anything.
+
+#define PANEL_INPUTS 16
+#define PANEL_DEBOUNCE_US 5000
+
+struct Panel {
+  uint16_t raw;               // last port read, 1 = pressed
+  uint16_t stable;            // debounced state
+  uint32_t changeTime[PANEL_INPUTS];
+  uint32_t reads;             // port reads (I2C transactions) in total
+  uint32_t readsPerSecond;
+  uint32_t windowStart;
+  uint32_t windowReads;
+
+  void begin(uint16_t initial, uint32_t now);
+  // Result of a port read triggered by INTA/INTB
+  void sample(uint16_t value, uint32_t now);
+  // Commits settled inputs as EVENT_TYPE_PANEL events, returns the bits that
+  // changed state
+  uint16_t update(uint32_t now, EventQueue& queue);
+  bool settling() const { return raw != stable; }
+};
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+// ----------------------------- Memory placement (Teensy 4.x)
+// FASTRUN   ITCM, zero wait state code: dispatch, allocator, output kernels,
+//           everything that runs per event, per tick or in an interrupt
+// FLASHMEM  code that only runs at startup or for debug output; executes
+//           from flash through the cache and leaves ITCM (RAM1) for data
+// PROGMEM   read-only tables that are only read off the hot path
+// DMAMEM    large buffers touched rarely (OCRAM, not zeroed at startup)
+// Plain globals and hot tables stay in DTCM, the linker's default.
+// tools/memory_report.py checks the hot symbols after every build.
+
+#if defined(__IMXRT1062__)
+#include <Arduino.h>
+#else
+#define FASTRUN
+#define FLASHMEM
+#define PROGMEM
+#define DMAMEM
+#endif
+
+#endif
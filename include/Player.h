@@ -0,0 +1,98 @@
+#ifndef PLAYER_H
+#define PLAYER_H
+
+#include <stdint.h>
+#include "EventQueue.h"
+#include "MidiClock.h"
+#include "Settings.h"
+
+// ----------------------------- Arpeggiator and step sequencer
+// Both run from the control tick. The transport position (beats << 32)
+// comes from the MIDI clock while it is locked, from Patch::internalTempo
+// otherwise; a step starts on the first tick at or past its boundary, so
+// note timing is the control tick's. Notes go out as ordinary Note On/Off
+// events, the caller feeds them to the engine's handleEvent() like any
+// other input.
+// Held keys are kept sorted (and in played order) in a fixed array. Adding
+// or removing a key is a shift over at most ARP_MAX_NOTES entries, an arp
+// step is an index move and one array read whatever the number of keys.
+// A play mode change forgets them, their Note Offs go elsewhere from then on.
+
+#define ARP_MAX_NOTES 16
+#define SEQUENCE_STEPS 64
+#define PLAYER_MAX_EVENTS 2            // note off and note on per tick
+#define NO_NOTE 0xFF
+#define EVENT_SOURCE_PLAYER NUM_EVENT_SOURCES  // never queued, no source stats
+
+// ----------------------------- Step sequence (SysEx block 3)
+struct SequenceStep {
+  uint8_t note;
+  uint8_t velocity;            // 0 = rest
+  uint8_t gateLength;          // eighths of a step, 0 = Patch::gateLength
+  uint8_t reserved;
+};
+
+struct Sequence {
+  uint8_t length;              // steps, 1..SEQUENCE_STEPS
+  uint8_t reserved[3];
+  SequenceStep steps[SEQUENCE_STEPS];
+};
+
+extern Sequence sequence;
+void sequenceDefaults();
+
+// ----------------------------- Held keys
+struct HeldNotes {
+  uint8_t sorted[ARP_MAX_NOTES];
+  uint8_t played[ARP_MAX_NOTES];
+  uint8_t velocity[128];
+  uint8_t count;
+
+  void clear() { count = 0; }
+  // False when full; a key that is already held only updates its velocity
+  bool add(uint8_t note, uint8_t noteVelocity);
+  void remove(uint8_t note);
+};
+
+// ----------------------------- Arpeggiator
+struct Arpeggiator {
+  uint8_t index;               // next entry of the pattern
+  uint8_t octave;
+  uint32_t random;
+  uint8_t key;                 // held key the last note came from
+
+  void reset();
+  // Next note of the pattern, NO_NOTE with no keys held
+  uint8_t next(const HeldNotes& held, uint8_t pattern, uint8_t octaves);
+};
+
+// ----------------------------- Player
+struct Player {
+  HeldNotes held;
+  Arpeggiator arp;
+  uint64_t internalPosition;   // beats << 32
+  bool stepValid;              // lastStep holds a step of the running transport
+  uint32_t lastStep;
+  uint8_t mode;                // playMode the state below belongs to
+  uint8_t playing;             // sounding note, NO_NOTE if none
+  uint64_t offAt;              // position its note off is due
+  MidiEvent events[PLAYER_MAX_EVENTS];
+  uint8_t eventCount;
+  uint32_t steps;
+
+  void begin();
+  // Keyboard Note On/Off while the arpeggiator is on
+  void keyEvent(const MidiEvent& event);
+  // Once per control tick; returns the number of events in events[]
+  uint8_t tick(const Patch& patch, const MidiClock& clock, uint32_t now, uint32_t tickUs);
+
+  // No note sounding and none coming without new input
+  bool idle(uint8_t playMode) const {
+    return playing == NO_NOTE && (playMode == PLAY_MODE_LIVE || (playMode == PLAY_MODE_ARP && held.count == 0));
+  }
+
+  void emit(uint8_t type, uint8_t note, uint8_t velocity, uint32_t now);
+  void release(uint32_t now);
+};
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include <stdint.h>
+#include "Budget.h"
+#include "EventQueue.h"
+
+// ----------------------------- Timestamp-scheduled output
+// With a latency set, the output change for an event goes out at its ingest
+// time plus that latency instead of at the next output pass, so the delay
+// from ingest to CV no longer depends on what the loop was busy with. The
+// loop takes events off the queue a little ahead of their due time into a
+// staged copy of the engine and arms a one-shot hardware timer; the timer
+// writes the staged frame. Events due within SCHEDULE_MERGE_US of the first
+// (chords) go out in the same frame. Latency 0 keeps the old behaviour:
+// dispatch right away, output at the next control tick.
+
+#define SCHEDULE_AHEAD_US 500         // stage this long before due
+#define SCHEDULE_MERGE_US 100
+#define SCHEDULE_MAX_LATENCY_US 20000
+#define ONSET_BUCKET_SHIFT 5          // 32 µs onset buckets, wider for long latencies
+
+struct OutputSchedule {
+  uint32_t latency;                   // µs, 0 = immediate
+  bool staged;                        // a batch has been taken off the queue
+  bool armed;                         // its frame is rendered, timer running
+  volatile bool committed;            // the timer wrote it
+  uint32_t dueTime;
+  uint32_t firstEvent;                // ingest time of the batch's first event
+  uint32_t late;                      // batches armed after their due time
+  BudgetMonitor onset;                // ingest to output, µs
+  uint32_t bestOnset;
+
+  void begin(uint32_t latencyUs);
+  // Clamps the latency; a new one restarts the onset histogram
+  void setLatency(uint32_t latencyUs);
+  void beginOnset();
+  // True if the queue's front event goes into the current batch. Starts a
+  // batch when none is pending and the event is due within SCHEDULE_AHEAD_US.
+  bool take(const MidiEvent& event, uint32_t now);
+  // Closes the batch; returns µs until it is due, <= 0 means write it now
+  int32_t arm(uint32_t now);
+  // The staged frame was written (timer context)
+  void commit(uint32_t now);
+  // True once per committed batch, the caller then adopts the staged engine
+  bool adopt();
+  void recordOnset(uint32_t latencyUs);
+};
+
+#endif
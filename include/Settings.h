@@ -0,0 +1,90 @@
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include <stdint.h>
+
+// Voice count of the firmware; set it with -D NUM_VOICES=... so every file
+// of the build agrees (the routed output build uses 16)
+#ifndef NUM_VOICES
+#define NUM_VOICES 8
+#endif
+#define MAX_VOICES 64               // largest VoiceEngineT the code supports
+
+#define DEFAULT_PITCH_BEND_RANGE 2
+#define DEFAULT_LFO_DEPTH_CENTS 50
+#define DEFAULT_OUTPUT_LATENCY_US 1500
+#define DEFAULT_INTERNAL_TEMPO 12000
+#define DEFAULT_GLIDE_TIME 60
+#define INTERNAL_TEMPO_MIN 2000     // 20-300 BPM, the range MIDI clock is tracked over
+#define INTERNAL_TEMPO_MAX 30000
+#define STEPS_PER_BEAT_MAX 24       // one step per MIDI clock tick
+#define CAL_GAIN_UNITY 16384
+
+// Patch::playMode
+#define PLAY_MODE_LIVE 0
+#define PLAY_MODE_ARP 1             // held keys feed the arpeggiator
+#define PLAY_MODE_SEQUENCE 2        // step sequencer, keys play along
+
+// Patch::keyMode
+#define KEY_MODE_POLY 0
+#define KEY_MODE_MONO 1             // one voice, every new note retriggers
+#define KEY_MODE_LEGATO 2           // one voice, overlapping notes glide
+
+// Patch::keyPriority, which held key a mono voice plays
+#define KEY_PRIORITY_LAST 0
+#define KEY_PRIORITY_LOW 1
+#define KEY_PRIORITY_HIGH 2
+
+// Patch::arpPattern
+#define ARP_UP 0
+#define ARP_DOWN 1
+#define ARP_RANDOM 2
+#define ARP_AS_PLAYED 3
+
+// ----------------------------- Patch settings (SysEx block 0)
+struct Patch {
+  uint8_t pitchBendRange;     // semitones
+  uint8_t lfoDepthCents;      // tempo-synced LFO depth at full modwheel
+  int8_t detune;
+  uint8_t cvLfoDepth;         // semitones the LFO CV input sweeps over its range, 0 = off
+  uint16_t outputLatency;     // µs from ingest to CV, 0 = next control tick
+  uint8_t playMode;           // PLAY_MODE_*
+  uint8_t arpPattern;         // ARP_*
+  uint8_t arpOctaves;         // 1..4
+  uint8_t stepsPerBeat;       // arp and sequencer rate, 4 = sixteenths
+  uint8_t gateLength;         // eighths of a step, 1..8
+  uint8_t reserved2;
+  uint16_t internalTempo;     // 1/100 BPM, while no MIDI clock is locked
+  uint8_t keyMode;            // KEY_MODE_*
+  uint8_t keyPriority;        // KEY_PRIORITY_*
+  uint16_t glideTime;         // control ticks (ms) a legato glide takes, 0 = none
+};
+
+// ----------------------------- Per-voice CV calibration (SysEx block 1)
+// Sized like the engine that reads it; the firmware's is Calibration
+template <uint8_t VOICES>
+struct CalibrationT {
+  uint16_t voltGain[VOICES];      // 14 bit fraction, CAL_GAIN_UNITY = 1.0
+  int16_t voltOffset[VOICES];     // DAC counts
+};
+
+typedef CalibrationT<NUM_VOICES> Calibration;
+
+template <uint8_t VOICES>
+void calibrationDefaults(CalibrationT<VOICES>& table) {
+  for (int i = 0; i < VOICES; i++) {
+    table.voltGain[i] = CAL_GAIN_UNITY;
+    table.voltOffset[i] = 0;
+  }
+}
+
+extern Patch patch;
+extern Calibration calibration;
+
+void patchDefaults();
+void calibrationDefaults();
+// After a SysEx load: fields out of range are clamped, unknown modes go back
+// to their default
+void patchValidate();
+
+#endif
@@ -0,0 +1,347 @@
+#ifndef SPI_OUTPUT_H
+#define SPI_OUTPUT_H
+
+#include <stdint.h>
+#include <Arduino.h>
+#include <SPI.h>
+#include <DMAChannel.h>
+#include "CvOutput.h"
+
+// ----------------------------- SPI output backends (device only)
+// SpiDacOutput and Ad9833Output drive chip selects by hand around each
+// command, all commands of a frame share one SPI transaction.
+// DmaSpiDacOutput hands the whole frame to DMA and LPSPI4's own chip selects.
+
+// ----------------------------- SPI DAC, CHANNELS voices per chip select
+// Chip is a traits struct: channel count, frame length, bus settings and how
+// one channel write is packed.
+struct Mcp48cxb8 {
+  // MCP48CVB28 and pin compatible parts: 8 channels, 12 bit, 24 bit commands
+  static const uint8_t CHANNELS = 8;
+  static const uint8_t FRAME_BYTES = 3;
+  static const uint32_t CLOCK = 20000000;
+  static const uint8_t MODE = SPI_MODE0;
+
+  // DACn register, write command, 14 bit CV to 12 bit DAC
+  static uint32_t word(uint8_t channel, uint16_t volts) {
+    return (uint32_t)channel << 19 | (volts >> 2);
+  }
+
+  static void pack(uint8_t channel, uint16_t volts, uint8_t* out) {
+    uint32_t command = word(channel, volts);
+    out[0] = command >> 16;
+    out[1] = command >> 8;
+    out[2] = command & 0xFF;
+  }
+};
+
+template <class Chip, uint8_t CHIPS>
+struct SpiDacOutput : CvOutput<SpiDacOutput<Chip, CHIPS> > {
+  const uint8_t* csPin;
+  uint16_t volts[CHIPS * Chip::CHANNELS];
+  uint32_t dirty;                                        // bit per voice
+  CvFrames cvFrames;
+
+  void begin(const uint8_t* csPins) {
+    csPin = csPins;
+    cvFrames.begin();
+    for (int chip = 0; chip < CHIPS; chip++) {
+      pinMode(csPin[chip], OUTPUT);
+      digitalWriteFast(csPin[chip], HIGH);
+    }
+    for (int i = 0; i < CHIPS * Chip::CHANNELS; i++) {
+      volts[i] = 0xFFFF;
+    }
+    SPI.begin();
+  }
+
+  // Nothing to set up on the chips, their power-on state is zero output
+  uint32_t bringUp(uint32_t now) {
+    (void)now;
+    return CHIPS * Chip::CHANNELS < 32 ? (1u << (CHIPS * Chip::CHANNELS)) - 1 : 0xFFFFFFFF;
+  }
+
+  void beginFrame(uint32_t now) {
+    (void)now;
+    dirty = 0;
+  }
+
+  void writeVoice(uint8_t voice, const Voice& v) {
+    if (v.bentNoteVolts != volts[voice]) {
+      volts[voice] = v.bentNoteVolts;
+      dirty |= 1u << voice;
+    }
+  }
+
+  void endFrame(uint32_t now) {
+    uint32_t number = cvFrames.start();
+    if (dirty == 0) {
+      cvFrames.done(number, now);
+      return;
+    }
+    SPI.beginTransaction(SPISettings(Chip::CLOCK, MSBFIRST, Chip::MODE));
+    while (dirty) {
+      uint8_t voice = __builtin_ctz(dirty);
+      dirty &= dirty - 1;
+      uint8_t frame[Chip::FRAME_BYTES];
+      Chip::pack(voice % Chip::CHANNELS, volts[voice], frame);
+      digitalWriteFast(csPin[voice / Chip::CHANNELS], LOW);
+      SPI.transfer(frame, Chip::FRAME_BYTES);
+      digitalWriteFast(csPin[voice / Chip::CHANNELS], HIGH);
+    }
+    SPI.endTransaction();
+    cvFrames.done(number, micros());
+  }
+};
+
+// ----------------------------- AD9833 DDS, one chip (and FSYNC pin) per voice
+// Takes the unrounded frequency and writes FREQ0 as a 28 bit word, LSBs then
+// MSBs, only when the word changed. bringUp() resets and configures one chip
+// per call, frames leave the others alone until then.
+#define AD9833_CLOCK 10000000
+#define AD9833_CONTROL_B28 0x2000
+#define AD9833_CONTROL_RESET 0x0100
+#define AD9833_CONTROL_MODE 0x0002                       // triangle
+#define AD9833_FREQ0 0x4000
+
+template <uint8_t VOICES>
+struct Ad9833Output : CvOutput<Ad9833Output<VOICES> > {
+  const uint8_t* fsyncPin;
+  uint32_t word[VOICES];
+  uint16_t dirty;
+  uint32_t ready;                                        // bit per voice
+  CvFrames cvFrames;
+
+  void send(uint8_t voice, uint16_t value) {
+    digitalWriteFast(fsyncPin[voice], LOW);
+    SPI.transfer16(value);
+    digitalWriteFast(fsyncPin[voice], HIGH);
+  }
+
+  void begin(const uint8_t* fsyncPins) {
+    fsyncPin = fsyncPins;
+    cvFrames.begin();
+    SPI.begin();
+    for (int i = 0; i < VOICES; i++) {
+      pinMode(fsyncPin[i], OUTPUT);
+      digitalWriteFast(fsyncPin[i], HIGH);
+      word[i] = 0;
+    }
+    ready = 0;
+  }
+
+  uint32_t bringUp(uint32_t now) {
+    (void)now;
+    if (ready != (1u << VOICES) - 1) {
+      uint8_t i = __builtin_ctz(~ready);
+      SPI.beginTransaction(SPISettings(AD9833_CLOCK, MSBFIRST, SPI_MODE2));
+      send(i, AD9833_CONTROL_B28 | AD9833_CONTROL_RESET);
+      send(i, AD9833_FREQ0);
+      send(i, AD9833_FREQ0);
+      send(i, AD9833_CONTROL_B28 | AD9833_CONTROL_MODE);
+      SPI.endTransaction();
+      ready |= 1u << i;
+    }
+    return ready;
+  }
+
+  void beginFrame(uint32_t now) {
+    (void)now;
+    dirty = 0;
+  }
+
+  void writeVoice(uint8_t voice, const Voice& v) {
+    uint32_t frequencyWord = ad9833Word(v.bentFrequency);
+    if (frequencyWord != word[voice] && (ready & (1u << voice))) {
+      word[voice] = frequencyWord;
+      dirty |= 1u << voice;
+    }
+  }
+
+  void endFrame(uint32_t now) {
+    uint32_t frame = cvFrames.start();
+    if (dirty == 0) {
+      cvFrames.done(frame, now);
+      return;
+    }
+    SPI.beginTransaction(SPISettings(AD9833_CLOCK, MSBFIRST, SPI_MODE2));
+    while (dirty) {
+      uint8_t voice = __builtin_ctz(dirty);
+      dirty &= dirty - 1;
+      // With B28 set the two FREQ0 writes are taken as one 28 bit update
+      digitalWriteFast(fsyncPin[voice], LOW);
+      SPI.transfer16(AD9833_CONTROL_B28 | AD9833_CONTROL_MODE);
+      SPI.transfer16(AD9833_FREQ0 | (word[voice] & 0x3FFF));
+      SPI.transfer16(AD9833_FREQ0 | ((word[voice] >> 14) & 0x3FFF));
+      digitalWriteFast(fsyncPin[voice], HIGH);
+    }
+    SPI.endTransaction();
+    cvFrames.done(frame, micros());
+  }
+};
+
+// ----------------------------- SPI DAC through DMA and hardware chip selects
+// Every frame refreshes all channels from one buffer of {TCR, TDR} pairs.
+// TCR and TDR sit next to each other in LPSPI4, so each DMA minor loop writes
+// both and steps back: the TCR word picks the chip select (PCS) for the
+// command that follows and LPSPI4 frames it by itself. Nothing runs on the
+// CPU between endFrame() and the completion interrupt, which stores how long the
+// frame took. Frames are double buffered; a tick that finds the previous
+// frame still running is counted and skipped, the next one carries the
+// newer values. Chip select pins must be LPSPI4 PCS pins (10, 36, 37);
+// begin() returns false for any other and the output stays off.
+#define SPI_DMA_TX_WATER 12                              // FIFO is 16 words, a pair is 2
+
+template <class Chip, uint8_t CHIPS>
+struct DmaSpiDacOutput : CvOutput<DmaSpiDacOutput<Chip, CHIPS> > {
+  static const uint8_t CHANNELS = CHIPS * Chip::CHANNELS;
+  static DmaSpiDacOutput* instance;
+
+  uint32_t buffer[2][CHANNELS * 2];                      // TCR, TDR per channel
+  uint8_t fill;                                          // buffer being written
+  DMAChannel dma;
+  volatile bool busy;
+  bool started;                                          // begin() succeeded
+  uint32_t startCycles;
+  volatile uint32_t lastCycles;                          // fire to last SCK edge
+  volatile uint32_t worstCycles;
+  volatile uint32_t frames;
+  uint32_t skipped;
+  CvFrames cvFrames;
+  uint32_t dmaFrame;                                     // number of the frame in flight
+
+  static void dmaInterrupt() {
+    instance->dma.clearInterrupt();
+    // DMA is done once the last pair is in the FIFO, the wire is not
+    LPSPI4_SR = LPSPI_SR_TCF;
+    if ((LPSPI4_FSR & 0x1F) == 0 && !(LPSPI4_SR & LPSPI_SR_MBF)) {
+      instance->complete();
+    } else {
+      LPSPI4_IER = LPSPI_IER_TCIE;
+    }
+  }
+
+  static void spiInterrupt() {
+    LPSPI4_IER = 0;
+    LPSPI4_SR = LPSPI_SR_TCF;
+    instance->complete();
+  }
+
+  void complete() {
+    uint32_t cycles = ARM_DWT_CYCCNT - startCycles;
+    lastCycles = cycles;
+    if (cycles > worstCycles) {
+      worstCycles = cycles;
+    }
+    frames++;
+    cvFrames.done(dmaFrame, micros());
+    busy = false;
+  }
+
+  bool begin(const uint8_t* csPins) {
+    instance = this;
+    started = false;
+    busy = false;
+    cvFrames.begin();
+    // setCS() returns the PCS bit, 0 for a pin with no hardware chip select
+    uint8_t pcs[CHIPS];
+    for (int chip = 0; chip < CHIPS; chip++) {
+      uint8_t mask = SPI.setCS(csPins[chip]);
+      if (mask == 0) {
+        return false;
+      }
+      pcs[chip] = __builtin_ctz(mask);
+    }
+    SPI.begin();
+    // Clock divider and delays come from the SPI library's setup
+    SPI.beginTransaction(SPISettings(Chip::CLOCK, MSBFIRST, Chip::MODE));
+    SPI.endTransaction();
+    uint32_t tcr = (LPSPI4_TCR & ~(LPSPI_TCR_FRAMESZ(0xFFF) | LPSPI_TCR_PCS(3) | LPSPI_TCR_CONT))
+                 | LPSPI_TCR_FRAMESZ(Chip::FRAME_BYTES * 8 - 1) | LPSPI_TCR_RXMSK;
+    for (int chip = 0; chip < CHIPS; chip++) {
+      for (int channel = 0; channel < Chip::CHANNELS; channel++) {
+        int n = chip * Chip::CHANNELS + channel;
+        for (int b = 0; b < 2; b++) {
+          buffer[b][n * 2] = tcr | LPSPI_TCR_PCS(pcs[chip]);
+          buffer[b][n * 2 + 1] = Chip::word(channel, 0);
+        }
+      }
+    }
+    fill = 0;
+    worstCycles = 0;
+    frames = 0;
+    skipped = 0;
+
+    LPSPI4_FCR = LPSPI_FCR_TXWATER(SPI_DMA_TX_WATER);
+    LPSPI4_DER = LPSPI_DER_TDDE;
+    attachInterruptVector(IRQ_LPSPI4, spiInterrupt);
+    NVIC_ENABLE_IRQ(IRQ_LPSPI4);
+
+    dma.begin();
+    dma.TCD->SOFF = 4;
+    dma.TCD->ATTR = DMA_TCD_ATTR_SSIZE(2) | DMA_TCD_ATTR_DSIZE(2);
+    // 8 bytes per request: TCR then TDR, then back to TCR
+    dma.TCD->NBYTES_MLOFFYES = DMA_TCD_NBYTES_DMLOE | DMA_TCD_NBYTES_MLOFFYES_MLOFF(-8) | DMA_TCD_NBYTES_MLOFFYES_NBYTES(8);
+    dma.TCD->SLAST = 0;
+    dma.TCD->DADDR = &LPSPI4_TCR;
+    dma.TCD->DOFF = 4;
+    dma.TCD->DLASTSGA = 0;
+    dma.TCD->CITER_ELINKNO = CHANNELS;
+    dma.TCD->BITER_ELINKNO = CHANNELS;
+    dma.triggerAtHardwareEvent(DMAMUX_SOURCE_LPSPI4_TX);
+    dma.disableOnCompletion();
+    dma.interruptAtCompletion();
+    dma.attachInterrupt(dmaInterrupt);
+    started = true;
+    return true;
+  }
+
+  uint32_t bringUp(uint32_t now) {
+    (void)now;
+    if (!started) {
+      return 0;
+    }
+    return CHANNELS < 32 ? (1u << CHANNELS) - 1 : 0xFFFFFFFF;
+  }
+
+  // Every voice if begin() failed
+  uint32_t absentVoices() const {
+    return started ? 0 : (CHANNELS < 32 ? (1u << CHANNELS) - 1 : 0xFFFFFFFF);
+  }
+
+  void beginFrame(uint32_t now) {
+    (void)now;
+  }
+
+  void writeVoice(uint8_t voice, const Voice& v) {
+    buffer[fill][voice * 2 + 1] = Chip::word(voice % Chip::CHANNELS, v.bentNoteVolts);
+  }
+
+  void endFrame(uint32_t now) {
+    (void)now;
+    if (!started) {
+      return;
+    }
+    // A skipped frame goes out with the next one
+    uint32_t frame = cvFrames.start();
+    if (busy) {
+      skipped++;
+      return;
+    }
+    dmaFrame = frame;
+    busy = true;
+    startCycles = ARM_DWT_CYCCNT;
+    dma.TCD->SADDR = buffer[fill];
+    dma.enable();
+    // The next frame is written into the other buffer while this one runs
+    for (int n = 1; n < CHANNELS * 2; n += 2) {
+      buffer[fill ^ 1][n] = buffer[fill][n];
+    }
+    fill ^= 1;
+  }
+};
+
+template <class Chip, uint8_t CHIPS>
+DmaSpiDacOutput<Chip, CHIPS>* DmaSpiDacOutput<Chip, CHIPS>::instance;
+
+#endif
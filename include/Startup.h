@@ -0,0 +1,42 @@
+#ifndef STARTUP_H
+#define STARTUP_H
+
+#include <stdint.h>
+
+// ----------------------------- Staged startup
+// setup() returns as soon as MIDI is listening; the output chips come up
+// afterwards from the loop through the async bus (or one SPI chip per pass),
+// and each voice is handed to the allocator once its chip is ready. Times
+// are micros() after reset:
+//   listening    setup() returned, notes are taken from here
+//   firstVoice   the first voice could sound
+//   allVoices    every voice ready or absent (0 while some are still
+//                coming up)
+//   firstNote    first frame written with a gate open
+// Voices whose hardware the backend gave up on are absent: never allocated,
+// and startup completes without them. notesMasked counts note ons that
+// found no voice ready.
+
+struct Startup {
+  uint32_t listening;
+  uint32_t firstVoice;
+  uint32_t allVoices;
+  uint32_t firstNote;
+  uint32_t voiceMask;          // voices ready
+  uint32_t absentMask;         // voices given up on
+  uint32_t fullMask;
+  uint32_t notesMasked;
+
+  void begin(uint8_t voices);
+  bool complete() const { return (voiceMask | absentMask) == fullMask; }
+  // New ready and absent masks from the output backend; true if they changed
+  bool voicesReady(uint32_t mask, uint32_t absent, uint32_t now);
+  // Once per output frame with the gates it carries
+  void frameWritten(uint32_t gates, uint32_t now) {
+    if (firstNote == 0 && gates != 0) {
+      firstNote = now;
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef SYSEX_H
+#define SYSEX_H
+
+#include <stdint.h>
+
+// ----------------------------- SysEx bulk dump / load
+// Message layout (all bytes after F0 are 7 bit):
+//   F0 7D 44 01 <block>                              F7  request dump (7F = all)
+//   F0 7D 44 02 <block> <offH> <offL> <packed> <sum> F7  data chunk
+//   F0 7D 44 03 <block> <lenH> <lenL> <blockSum>     F7  end of block
+// Raw bytes are packed 7 to 8: a byte holding the seven MSBs, then the seven
+// low 7 bit parts. <sum> covers the packed bytes of one chunk as sent, so
+// every bit on the wire counts including the MSBs, <blockSum> runs over all
+// chunks of the block; both are the 7 bit two's complement of the byte sum.
+// Chunks are decoded straight into the destination struct as they arrive.
+// A bad chunk, a gap in the offsets or a wrong end summary puts the block
+// back to its defaults, so a broken transfer never leaves half a calibration.
+
+#define SYSEX_MANUFACTURER 0x7D     // non-commercial ID
+#define SYSEX_DEVICE 0x44
+#define SYSEX_CMD_REQUEST 0x01
+#define SYSEX_CMD_DATA 0x02
+#define SYSEX_CMD_END 0x03
+#define SYSEX_ALL_BLOCKS 0x7F
+
+#define SYSEX_BLOCK_PATCH 0
+#define SYSEX_BLOCK_CALIBRATION 1
+#define SYSEX_BLOCK_SCALA 2         // Scala text, see Tuning.h
+#define SYSEX_BLOCK_SEQUENCE 3      // step sequence, see Player.h
+
+#define SYSEX_CHUNK_BYTES 56        // raw bytes per data chunk, 64 on the wire
+#define SYSEX_FRAME_BYTES 9         // F0 7D 44 cmd block offH offL ... sum F7
+#define SYSEX_MAX_MESSAGE (SYSEX_FRAME_BYTES + SYSEX_CHUNK_BYTES / 7 * 8)
+
+struct SysExBlock {
+  uint8_t id;
+  uint8_t* data;
+  uint16_t size;
+  void (*defaults)();
+  void (*loaded)();           // after a complete, verified load; may be 0
+};
+
+struct SysExStream {
+  const SysExBlock* blocks;
+  uint8_t numBlocks;
+
+  // Receive side
+  const SysExBlock* rxBlock;
+  uint16_t rxOffset;
+  uint8_t rxSum;
+  uint16_t rxErrors;
+  uint16_t blocksLoaded;
+
+  // Transmit side
+  const SysExBlock* txBlock;
+  uint16_t txOffset;
+  uint8_t txSum;
+  bool txAll;
+
+  void begin(const SysExBlock* blockTable, uint8_t count);
+  // One complete message including F0/F7, as handed over by the MIDI input
+  void receive(const uint8_t* msg, unsigned len);
+  void requestDump(uint8_t blockId);
+  bool txPending() const { return txBlock != 0; }
+  // Builds the next outgoing message of a running dump, returns its length
+  unsigned nextMessage(uint8_t* out);
+
+  const SysExBlock* findBlock(uint8_t id) const;
+  void abortReceive();
+};
+
+#endif
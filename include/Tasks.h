@@ -0,0 +1,61 @@
+#ifndef TASKS_H
+#define TASKS_H
+
+#include <stdint.h>
+
+// ----------------------------- Cooperative task scheduler
+// loop() is one pass over a fixed table of tasks, defined at compile time
+// in priority order (0 first), nothing allocated. A task runs when its
+// period has elapsed (period 0: every pass) and the degrade level is not
+// above its maxDegrade. It returns whether it found work. Background tasks
+// (priority >= TASK_BACKGROUND) only start while the pass is younger than
+// TASK_SLICE_US, a skipped one stays due for the next pass, so adding one
+// never delays ingest, dispatch or the control tick by more than one task.
+// Every call is timed in CPU cycles for count, average and worst.
+
+#define TASK_BACKGROUND 8
+#define TASK_SLICE_US 100
+
+typedef bool (*TaskFunction)();
+
+struct Task {
+  const char* name;
+  TaskFunction run;
+  uint32_t period;             // µs, 0 = every pass
+  uint8_t priority;
+  uint8_t maxDegrade;          // skipped above this degrade level
+};
+
+struct TaskStats {
+  uint32_t calls;
+  uint32_t worked;             // calls that found work
+  uint64_t cycles;
+  uint32_t worst;              // cycles
+  uint32_t lastRun;            // µs
+  uint32_t deferred;           // background runs pushed to a later pass
+};
+
+// For static_assert on a task table
+constexpr bool tasksInPriorityOrder(const Task* tasks, int count) {
+  for (int i = 1; i < count; i++) {
+    if (tasks[i].priority < tasks[i - 1].priority) {
+      return false;
+    }
+  }
+  return true;
+}
+
+struct TaskScheduler {
+  const Task* tasks;
+  TaskStats* stats;
+  uint8_t count;
+  uint32_t (*cycles)();        // CPU cycle counter
+  uint32_t sliceCycles;
+
+  void begin(const Task* taskTable, TaskStats* taskStats, uint8_t taskCount, uint32_t (*cycleCounter)(), uint32_t cyclesPerUs, uint32_t now);
+  // One pass; returns a bit per task that found work
+  uint32_t run(uint32_t now, uint8_t degradeLevel);
+  uint32_t averageCycles(uint8_t task) const;
+};
+
+#endif
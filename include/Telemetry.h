@@ -0,0 +1,139 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+#include "Budget.h"
+#include "Tasks.h"
+#include "Trace.h"
+#include "VoiceEngine.h"
+
+// ----------------------------- Binary telemetry over USB serial
+// Frame on the wire: COBS encoded, terminated by 0x00, so a reader can join
+// at any byte and a corrupt frame costs only itself. Decoded frame:
+//   <type> <sequence> <time µs, 4> <payload> <CRC-16/CCITT over all before, 2>
+// Multi-byte fields are little endian. Payloads:
+//   VOICES     <count> then per voice <note> <flags> <volts, 2> <dds word, 4> <pressure>
+//   COUNTERS   <count> then <value, 4> per counter, in TELEMETRY_COUNTER_* order
+//   HISTOGRAM  <id> <bucket shift> <count, 4> <worst, 4> <overruns, 4>
+//              <first bucket> <buckets> then <value, 4> per bucket
+//   TASKS      <count> then per loop task <calls, 4> <worked, 4>
+//              <average cycles, 4> <worst cycles, 4> <deferred, 4>
+//   TRACE      <entries logged so far, 4> <count> then per entry, oldest
+//              first: <time µs, 4> <event> <work> <count, 2> <value, 4>
+// The sequence number counts every frame built, sent or not, so the host
+// sees how many were dropped. The writer is rate limited by a CPU budget:
+// a token bucket of cycles refilled at cpuPermille of the elapsed cycles, a
+// frame is only built while there is credit left.
+// tools/telemetry_monitor.cpp decodes the stream live or from a capture.
+
+#define TELEMETRY_VOICES 1
+#define TELEMETRY_COUNTERS 2
+#define TELEMETRY_HISTOGRAM 3
+#define TELEMETRY_TASKS 4
+#define TELEMETRY_TRACE 5
+
+#define TELEMETRY_VOICE_FLAG_ON 0x01
+#define TELEMETRY_VOICE_FLAG_KEY_DOWN 0x02
+#define TELEMETRY_VOICE_FLAG_SUSTAINED 0x04
+#define TELEMETRY_VOICE_FLAG_GATE 0x08
+
+// Histogram ids
+#define TELEMETRY_HIST_LOOP 0        // cycles
+#define TELEMETRY_HIST_TICK 1        // cycles
+#define TELEMETRY_HIST_ONSET 2       // µs
+#define TELEMETRY_HIST_GATE_SKEW 3   // µs
+#define TELEMETRY_HIST_WAKE 4        // µs
+#define TELEMETRY_HISTOGRAMS 5
+
+// Counter order in a COUNTERS frame
+#define TELEMETRY_COUNTER_DIN_RECEIVED 0
+#define TELEMETRY_COUNTER_USB_RECEIVED 1
+#define TELEMETRY_COUNTER_QUEUE_OVERFLOWS 2
+#define TELEMETRY_COUNTER_I2C_COMPLETED 3
+#define TELEMETRY_COUNTER_I2C_FAILED 4
+#define TELEMETRY_COUNTER_I2C_DROPPED 5
+#define TELEMETRY_COUNTER_I2C_UTILIZATION 6   // 1/10 %
+#define TELEMETRY_COUNTER_GATE_WRITES 7
+#define TELEMETRY_COUNTER_GATE_EARLY 8
+#define TELEMETRY_COUNTER_SCHEDULE_LATE 9
+#define TELEMETRY_COUNTER_DEGRADE_LEVEL 10
+#define TELEMETRY_COUNTER_TELEMETRY_DROPPED 11
+#define TELEMETRY_COUNTER_IDLE_ENTRIES 12
+#define TELEMETRY_COUNTER_VOICES_READY 13     // bit per voice
+#define TELEMETRY_COUNTER_FIRST_NOTE_US 14    // after reset, 0 = none yet
+#define TELEMETRY_COUNTER_CV_RATE 15          // LFO CV samples/s processed
+#define TELEMETRY_COUNTER_CV_NOISE 16         // LFO CV rms noise, 1/100 LSB
+#define TELEMETRY_COUNTER_VOICES_ABSENT 17    // bit per voice, hardware given up on
+#define TELEMETRY_COUNTER_PANEL_READS 18      // panel port reads in the last second
+#define TELEMETRY_COUNTER_I2C_WAIT 19         // average queue wait µs, per I2C priority
+#define TELEMETRY_COUNTER_I2C_WAIT_MAX 22     // worst queue wait µs, per I2C priority
+#define TELEMETRY_COUNTER_CV_WRITES_FAILED 25 // CV writes the DAC did not acknowledge
+#define TELEMETRY_COUNTER_DMA_FRAMES 26       // SPI DMA backend only, else 0
+#define TELEMETRY_COUNTER_DMA_SKIPPED 27
+#define TELEMETRY_COUNTER_DMA_LAST_NS 28      // frame fire to last SCK edge
+#define TELEMETRY_COUNTER_DMA_WORST_NS 29
+#define TELEMETRY_COUNTER_INPUT_FILTERED 30   // per event source (DIN, USB, panel)
+#define TELEMETRY_COUNTER_INPUT_LATENCY 33    // average ingest to dispatch µs, per source
+#define TELEMETRY_COUNTER_INPUT_LATENCY_MAX 36 // worst, per source
+#define TELEMETRY_COUNTER_I2C_MUX_SELECTS 39
+#define TELEMETRY_COUNTER_I2C_MUX_SKIPPED 40  // selects saved, channel already set
+#define TELEMETRY_COUNTER_OUTPUT_LATENCY 41   // scheduled output latency µs
+#define TELEMETRY_COUNTER_ONSET_BEST 42       // µs
+#define TELEMETRY_COUNTER_GATE_FAILED 43
+#define TELEMETRY_COUNTER_GATE_RETRIGGERS 44
+#define TELEMETRY_COUNTER_IDLE_MS 45          // spent in WFI
+#define TELEMETRY_COUNTER_STARTUP_LISTENING 46 // µs after reset
+#define TELEMETRY_COUNTER_STARTUP_FIRST_VOICE 47
+#define TELEMETRY_COUNTER_STARTUP_ALL_VOICES 48 // 0 while some are not ready
+#define TELEMETRY_COUNTER_NOTES_MASKED 49     // note ons before their voice was ready
+#define TELEMETRY_COUNTER_CV_VALUE 50         // LFO CV block mean, 16 bit
+#define TELEMETRY_COUNTER_CV_LOWEST 51
+#define TELEMETRY_COUNTER_CV_HIGHEST 52
+#define TELEMETRY_COUNTERS_COUNT 53
+
+#define TELEMETRY_MAX_PAYLOAD 280
+#define TELEMETRY_MAX_TASKS ((TELEMETRY_MAX_PAYLOAD - 1) / 20)
+#define TELEMETRY_MAX_TRACE ((TELEMETRY_MAX_PAYLOAD - 5) / 12)
+#define TELEMETRY_MAX_RAW (TELEMETRY_MAX_PAYLOAD + 8)
+#define TELEMETRY_MAX_FRAME (TELEMETRY_MAX_RAW + TELEMETRY_MAX_RAW / 254 + 2)
+#define TELEMETRY_BURST_CYCLES 600000        // credit cap, 1 ms at 600 MHz
+
+struct Telemetry {
+  uint8_t raw[TELEMETRY_MAX_RAW];
+  uint16_t rawLength;
+  uint8_t frame[TELEMETRY_MAX_FRAME];
+  uint8_t sequence;
+
+  uint16_t cpuPermille;
+  int32_t credit;                    // cycles
+  uint32_t lastCycles;
+  uint32_t sent;
+  uint32_t dropped;                  // built, but USB had no room for it
+
+  void begin(uint16_t permille, uint32_t nowCycles);
+  // Refills the credit; false while the budget is used up
+  bool allowed(uint32_t nowCycles);
+  void spent(uint32_t cycles) { credit -= (int32_t)cycles; }
+
+  // Frame builders; each returns the encoded length in frame[], delimiter
+  // included
+  uint16_t voices(const VoiceEngine& engine, uint32_t now);
+  uint16_t counters(const uint32_t* values, uint8_t count, uint32_t now);
+  uint16_t histogram(uint8_t id, const BudgetMonitor& monitor, uint32_t now);
+  uint16_t tasks(const TaskScheduler& scheduler, uint32_t now);
+  // Entries logged after the first since, the newest that fit
+  uint16_t trace(const TraceBuffer& buffer, uint32_t since, uint32_t now);
+
+  void start(uint8_t type, uint32_t now);
+  void put8(uint8_t value) { raw[rawLength++] = value; }
+  void put16(uint16_t value);
+  void put32(uint32_t value);
+  uint16_t finish();
+};
+
+uint16_t telemetryCrc(const uint8_t* data, uint16_t length);
+// COBS decodes one frame (delimiter not included) and checks its CRC;
+// returns the frame length without CRC, 0 if it is broken
+uint16_t telemetryDecode(const uint8_t* in, uint16_t length, uint8_t* out);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+// ----------------------------- Trace buffer
+// Small ring of timestamped events for things that go wrong in the field
+// (budget overruns, degradation changes). Logging is a handful of stores, so
+// it is safe from the loop and from the control tick.
+
+#define TRACE_SIZE 64   // power of two
+
+#define TRACE_LOOP_OVERRUN 1
+#define TRACE_TICK_OVERRUN 2
+#define TRACE_DEGRADE 3
+
+// Work done in the pass that is being traced, for attributing overruns
+#define WORK_EVENTS 0x01
+#define WORK_PANEL 0x02
+#define WORK_SYSEX 0x04
+#define WORK_TUNING 0x08
+#define WORK_TICK 0x10
+#define WORK_TELEMETRY 0x20
+
+struct TraceEntry {
+  uint32_t time;      // micros()
+  uint8_t event;
+  uint8_t work;       // WORK_* flags
+  uint16_t count;     // events dispatched, new level, ...
+  uint32_t value;     // duration in CPU cycles, ...
+};
+
+struct TraceBuffer {
+  TraceEntry entries[TRACE_SIZE];
+  uint32_t total;
+
+  void clear() { total = 0; }
+  void log(uint32_t time, uint8_t event, uint8_t work, uint16_t count, uint32_t value);
+  // n = 0 is the newest entry; false once n reaches past what is stored
+  bool get(uint32_t n, TraceEntry& entry) const;
+};
+
+extern TraceBuffer trace;
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef TUNING_H
+#define TUNING_H
+
+#include <stdint.h>
+
+// ----------------------------- Tuning tables
+// The output reads pitch per note from the active table exactly as it read
+// noteVolt[]/noteFrequency[], so any tuning costs the same as 12-TET. Slot n
+// is the engine's note index, slot 0 = C1 = 32.7 Hz like noteFrequency[0],
+// which makes slot n MIDI key n + TUNING_KEY_OFFSET for Scala keyboard maps.
+// CV values keep noteVolt[]'s scaling: linear in Hz, 0 at C1, 16383 at C7.
+// A new table is built off to the side and only swapped in at the start of
+// a control tick (tuningSwap()), never halfway through an output pass.
+
+#define TUNING_NOTES 128
+#define TUNING_KEY_OFFSET 24
+#define TUNING_MAX_DEGREES 128
+#define TUNING_BASE_FREQUENCY 32.7032
+#define TUNING_TOP_FREQUENCY 2093.0
+#define TUNING_TEXT_SIZE 2048          // SysEx text block: .scl, NUL, .kbm, NUL
+#define EQUAL_NOTES 73
+
+// ----------------------------- 12-TET reference, C1-C7
+// Only read to seed a table, so they stay in flash
+extern const float noteFrequency[EQUAL_NOTES];
+extern const unsigned int noteVolt[EQUAL_NOTES];
+
+struct TuningTable {
+  uint16_t noteVolt[TUNING_NOTES];
+  float noteFrequency[TUNING_NOTES];
+};
+
+// ----------------------------- Scala .scl / .kbm
+struct ScalaScale {
+  uint8_t count;                     // degrees, the last one is the period
+  float cents[TUNING_MAX_DEGREES];   // degree 1..count
+};
+
+struct ScalaKeyboard {
+  uint8_t mapSize;                   // 0 = linear, every key one degree
+  uint8_t firstKey;
+  uint8_t lastKey;
+  uint8_t middleKey;                 // key that plays degree 0
+  uint8_t referenceKey;
+  float referenceFrequency;
+  uint8_t octaveDegree;              // 0 = use the scale's period
+  int16_t map[TUNING_MAX_DEGREES];   // degree per map slot, -1 = unmapped
+};
+
+// Text parsers; false on malformed input. Lines starting with '!' are comments.
+bool scalaParseScale(const char* text, ScalaScale& scale);
+bool scalaParseKeyboard(const char* text, ScalaKeyboard& keyboard);
+// Standard mapping: degree 0 on key 60, A4 (key 69) = 440 Hz
+void scalaDefaultKeyboard(ScalaKeyboard& keyboard);
+// Unmapped and out-of-range keys keep the 12-TET pitch
+void tuningBuild(const ScalaScale& scale, const ScalaKeyboard& keyboard, TuningTable& table);
+void tuningEqual(TuningTable& table);
+uint16_t tuningVolts(double frequency);
+
+// ----------------------------- Active table
+extern const TuningTable* activeTuning;
+extern const TuningTable* pendingTuning;
+extern TuningTable tuningTables[2];
+
+// Table that is safe to build into (the one not playing)
+TuningTable& tuningBackBuffer();
+void tuningSchedule(const TuningTable& table);
+// Call at the start of a control tick
+void tuningSwap();
+
+#endif
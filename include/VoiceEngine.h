@@ -0,0 +1,172 @@
+#ifndef VOICE_ENGINE_H
+#define VOICE_ENGINE_H
+
+#include <stdint.h>
+#include "EventQueue.h"
+#include "Settings.h"
+#include "Tuning.h"
+
+// ----------------------------- Voice engine
+// Voice allocation, sustain, bend/modwheel state and the per-tick CV math.
+// Everything lives in the object, so the firmware runs one instance and a
+// host tool can run as many independent copies as it likes. Time comes in
+// from the caller (millis() on the device), patch, calibration and tuning are
+// read through pointers so copies can share or own them.
+// The voice count is a template parameter (VoiceEngine is the firmware's
+// NUM_VOICES), voice sets are bitmasks of 32 or 64 bits to match. Per event
+// the cost does not grow with the count: noteVoice[] indexes the sounding
+// voice of every MIDI note, a free voice is the lowest bit of voiceMask
+// minus gates, and a steal takes the head of a list of voices in note-on
+// order. Per tick every voice is rendered. Notes are only allocated to
+// voices in voiceMask (all after begin()); the firmware narrows it while the
+// output hardware of some voices is still coming up.
+// Patch::keyMode MONO and LEGATO play one voice, the lowest in voiceMask,
+// from a stack of held keys: releasing the sounding key falls back to the
+// one with priority among those still held. Mono retriggers the gate on
+// every note change, legato keeps it open while keys overlap and glides to
+// the new pitch over glideTime ticks instead. The mono voice renders and
+// goes out like any other, a glide costs one extra voice render per tick
+// while it runs.
+
+#define NO_VOICE -1
+#define PRESSURE_SMOOTH_SHIFT 3         // one-pole, ~8 control ticks
+#define KEY_STACK_SIZE 16
+#define NO_KEY 0xFF
+
+// Voice bitmask type for a voice count
+template <bool WIDE>
+struct VoiceBits {
+  typedef uint32_t Mask;
+  static int lowest(Mask mask) { return __builtin_ctz(mask); }
+};
+
+template <>
+struct VoiceBits<true> {
+  typedef uint64_t Mask;
+  static int lowest(Mask mask) { return __builtin_ctzll(mask); }
+};
+
+struct Voice {
+  unsigned long noteAge;
+  uint8_t midiNote;
+  bool noteOn;
+  bool sustained;
+  bool keyDown;
+  uint8_t velocity;
+  uint8_t prevNote;
+  uint16_t bentNoteVolts;
+  uint16_t bentNoteFreq;
+  float bentFrequency;               // bentNoteFreq unrounded, for DDS outputs
+  uint8_t pressureTarget;            // last poly pressure for this voice's note
+  uint16_t pressure;                 // smoothed per tick, 7.8 fixed point
+  uint8_t noteCount;                 // counts note ons, tells a retrigger apart
+};
+
+// ----------------------------- Held keys for the mono modes
+// Fixed slots linked in press order, found by note through slot[], so a
+// push or a remove anywhere in the order is O(1). A bit per held note gives
+// the lowest and highest key in at most four words. Full, a push drops the
+// oldest key.
+struct KeyStack {
+  uint8_t slot[128];                 // slot holding each note, NO_KEY if not held
+  uint8_t note[KEY_STACK_SIZE];
+  uint8_t velocity[KEY_STACK_SIZE];
+  uint8_t older[KEY_STACK_SIZE];     // press order through the slots
+  uint8_t newer[KEY_STACK_SIZE];
+  uint8_t oldest;                    // slots, NO_KEY while empty
+  uint8_t newest;
+  uint8_t freeSlots[KEY_STACK_SIZE]; // first KEY_STACK_SIZE - count are free
+  uint8_t count;
+  uint32_t held[4];                  // bit per note
+
+  void clear();
+  // A key already held moves to the newest end with its new velocity
+  void push(uint8_t key, uint8_t keyVelocity);
+  void remove(uint8_t key);
+  // Key with priority (KEY_PRIORITY_*), NO_KEY while empty
+  uint8_t top(uint8_t priority) const;
+  uint8_t velocityOf(uint8_t key) const { return velocity[slot[key]]; }
+};
+
+template <uint8_t VOICES>
+struct VoiceEngineT {
+  static_assert(VOICES >= 1 && VOICES <= MAX_VOICES, "voice count out of range");
+  typedef VoiceBits<(VOICES > 32)> Bits;
+  typedef typename Bits::Mask Mask;
+
+  Voice voices[VOICES];
+  int8_t noteVoice[128];             // voice sounding each note, or NO_VOICE
+  Mask gates;                        // bit per voice, open while the note sounds
+  Mask voiceMask;                    // voices notes may be allocated to
+  uint8_t older[VOICES];             // note-on order, oldest to newest
+  uint8_t newer[VOICES];
+  uint8_t oldest;
+  uint8_t newest;
+  bool susOn;
+  double pitchBendFreq;
+  int pitchBendVolts;
+  uint8_t aftertouch;
+  uint8_t modulationWheel;
+  uint8_t sustainPedal;
+  uint8_t knobNumber;
+  uint8_t knobValue;
+  double lfoSemitones;
+  double cvSemitones;                // from the LFO CV input
+  KeyStack keys;                     // held keys, mono modes
+  int8_t monoVoice;                  // voice of the mono modes, NO_VOICE before the first note
+  double glideSemitones;             // mono voice pitch offset from its note
+  double glideStep;                  // per tick
+  uint16_t glideTicks;               // left of the running glide
+
+  const Patch* patch;
+  const CalibrationT<VOICES>* calibration;
+  const TuningTable* tuning;
+
+  static Mask bit(int voice) { return (Mask)1 << voice; }
+  // Every voice; 2 << (VOICES - 1) wraps to 0 at the full width
+  static Mask all() { return ((Mask)2 << (VOICES - 1)) - 1; }
+
+  void begin(const Patch* patch, const CalibrationT<VOICES>* calibration, const TuningTable* tuning);
+  void initializeVoices();
+  int findOldestVoice() const;
+  int findVoice(uint8_t midiNote) const;
+  void noteOn(uint8_t midiNote, uint8_t velocity, unsigned long now);
+  void noteOff(uint8_t midiNote);
+  // Mono modes: a pressed key, and the mono voice to a held key
+  void monoNoteOn(uint8_t midiNote, uint8_t velocity, unsigned long now);
+  void monoPlay(uint8_t midiNote, uint8_t velocity, unsigned long now);
+  void sustainNotes();
+  void unsustainNotes();
+  // Every key let go at once, as on its Note Off; the pedal still holds
+  void releaseKeys();
+  // Channel voice messages; now is the note age clock (ms). Pressure only
+  // sets a target, it reaches the voices at the next smoothPressure().
+  void handleEvent(const MidiEvent& event, unsigned long now);
+  // Once per control tick: moves every voice's pressure toward its target
+  void smoothPressure();
+  // Once per control tick: moves a legato glide one step toward the note
+  void glide();
+
+  // Tempo-synced triangle, one cycle per 2^32 phase, depth on modwheel
+  void updateLfo(uint32_t phase);
+  // External LFO CV, 16 bit with half scale as no offset, over cvLfoDepth
+  void updateCvLfo(uint16_t level);
+  // Bend and both LFOs as a frequency ratio, the same for every voice
+  double pitchFactor() const;
+  // Extra ratio of the mono voice while it glides, 1 otherwise
+  double glideFactor() const;
+  // Fills bentNoteVolts/bentNoteFreq of every voice from the current state
+  void render();
+  void renderVoice(int voice, double factor);
+  // Nothing sounding and nothing that moves the CV on its own (LFO depth, LFO
+  // CV input, a glide, pressure still settling), so further ticks would not change
+  // the output
+  bool idle() const;
+
+  // Moves a voice to the newest end of the note-on order
+  void touch(uint8_t voice);
+};
+
+typedef VoiceEngineT<NUM_VOICES> VoiceEngine;
+
+#endif
@@ -0,0 +1,63 @@
+#include <math.h>
+#include "AnalogInput.h"
+#include "Placement.h"
+
+// Sums of squares are 32 bit
+static_assert((uint64_t)ANALOG_BLOCK * 4095 * 4095 <= 0xFFFFFFFFu, "block too long for 32 bit sums");
+static_assert((1 << ANALOG_BLOCK_SHIFT) == ANALOG_BLOCK, "ANALOG_BLOCK_SHIFT must match ANALOG_BLOCK");
+
+FLASHMEM void AnalogInput::begin() {
+  for (int i = 0; i < ANALOG_CHANNELS; i++) {
+    value[i] = ANALOG_MID;
+    blocks[i] = 0;
+    noiseSum[i] = 0;
+    lowest[i] = 0xFFFF;
+    highest[i] = 0;
+    lastBlockAt[i] = 0;
+    timedBlocks[i] = 0;
+    timedUs[i] = 0;
+  }
+}
+
+FASTRUN void AnalogInput::block(uint8_t channel, const volatile uint16_t* samples, uint32_t now) {
+  uint32_t sum = 0;
+  uint32_t squares = 0;
+  for (int i = 0; i < ANALOG_BLOCK; i++) {
+    uint32_t sample = samples[i] & ((1 << ANALOG_ADC_BITS) - 1);
+    sum += sample;
+    squares += sample * sample;
+  }
+  // Mean as 16 bit: sum / ANALOG_BLOCK << (16 - ANALOG_ADC_BITS)
+  uint16_t mean = (uint16_t)(sum >> (ANALOG_BLOCK_SHIFT - (16 - ANALOG_ADC_BITS)));
+  value[channel] = mean;
+  // n * variance = sum of squares - sum^2 / n
+  noiseSum[channel] += squares - (uint32_t)(((uint64_t)sum * sum) >> ANALOG_BLOCK_SHIFT);
+  if (mean < lowest[channel]) {
+    lowest[channel] = mean;
+  }
+  if (mean > highest[channel]) {
+    highest[channel] = mean;
+  }
+  uint32_t gap = now - lastBlockAt[channel];
+  if (blocks[channel] != 0 && gap <= ANALOG_GAP_US) {
+    timedBlocks[channel]++;
+    timedUs[channel] += gap;
+  }
+  lastBlockAt[channel] = now;
+  blocks[channel]++;
+}
+
+FLASHMEM uint32_t AnalogInput::rate(uint8_t channel) const {
+  if (timedUs[channel] == 0) {
+    return 0;
+  }
+  return (uint32_t)((uint64_t)timedBlocks[channel] * ANALOG_BLOCK * 1000000 / timedUs[channel]);
+}
+
+FLASHMEM uint32_t AnalogInput::noiseCentiLsb(uint8_t channel) const {
+  if (blocks[channel] == 0) {
+    return 0;
+  }
+  double variance = (double)noiseSum[channel] / ((double)blocks[channel] * ANALOG_BLOCK);
+  return (uint32_t)(sqrt(variance) * 100.0 + 0.5);
+}
@@ -0,0 +1,59 @@
+#include "Budget.h"
+#include "Placement.h"
+
+void BudgetMonitor::begin(uint32_t budgetCycles, uint8_t shift) {
+  budget = budgetCycles;
+  bucketShift = shift;
+  count = 0;
+  worst = 0;
+  overruns = 0;
+  for (int i = 0; i < BUDGET_BUCKETS; i++) {
+    histogram[i] = 0;
+  }
+}
+
+FASTRUN bool BudgetMonitor::record(uint32_t cycles) {
+  uint32_t bucket = cycles >> bucketShift;
+  if (bucket >= BUDGET_BUCKETS) {
+    bucket = BUDGET_BUCKETS - 1;
+  }
+  histogram[bucket]++;
+  count++;
+  if (cycles > worst) {
+    worst = cycles;
+  }
+  if (cycles > budget) {
+    overruns++;
+    return true;
+  }
+  return false;
+}
+
+uint32_t BudgetMonitor::percentile(uint16_t permille) const {
+  uint32_t target = (uint32_t)((uint64_t)count * permille / 1000);
+  uint32_t seen = 0;
+  for (int i = 0; i < BUDGET_BUCKETS; i++) {
+    seen += histogram[i];
+    if (seen > target) {
+      return (uint32_t)(i + 1) << bucketShift;
+    }
+  }
+  return worst;
+}
+
+FASTRUN bool Degrader::update(bool overrun) {
+  if (overrun) {
+    cleanTicks = 0;
+    if (level < DEGRADE_MAX) {
+      level++;
+      return true;
+    }
+    return false;
+  }
+  if (level > 0 && ++cleanTicks >= DEGRADE_RECOVER_TICKS) {
+    cleanTicks = 0;
+    level--;
+    return true;
+  }
+  return false;
+}
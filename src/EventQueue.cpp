@@ -0,0 +1,77 @@
+#include "EventQueue.h"
+#include "Placement.h"
+
+#define EVENT_QUEUE_MASK (EVENT_QUEUE_SIZE - 1)
+
+void EventQueue::begin() {
+  head = 0;
+  count = 0;
+  for (int i = 0; i < NUM_EVENT_SOURCES; i++) {
+    sources[i].channelMask = 0xFFFF;
+    sources[i].typeMask = EVENT_TYPES_ALL;
+    sources[i].received = 0;
+    sources[i].filtered = 0;
+    sources[i].overflows = 0;
+    sources[i].dispatched = 0;
+    sources[i].latencySum = 0;
+    sources[i].latencyMax = 0;
+  }
+}
+
+void EventQueue::setFilter(uint8_t source, uint16_t channelMask, uint8_t typeMask) {
+  sources[source].channelMask = channelMask;
+  sources[source].typeMask = typeMask;
+}
+
+FASTRUN bool EventQueue::accepts(uint8_t source, uint8_t type, uint8_t channel) {
+  EventSource& from = sources[source];
+  from.received++;
+  bool system = type >= 0xF0;
+  if (!(from.typeMask & EVENT_TYPE_BIT(type)) || (!system && !(from.channelMask & (1u << ((channel - 1) & 15))))) {
+    from.filtered++;
+    return false;
+  }
+  return true;
+}
+
+FASTRUN bool EventQueue::push(const MidiEvent& event) {
+  if (!accepts(event.source, event.type, event.channel)) {
+    return false;
+  }
+  if (count == EVENT_QUEUE_SIZE) {
+    sources[event.source].overflows++;
+    return false;
+  }
+  // Shift later events up until the slot for this timestamp is found
+  uint8_t slot = (head + count) & EVENT_QUEUE_MASK;
+  for (uint8_t n = count; n > 0; n--) {
+    uint8_t previous = (slot - 1) & EVENT_QUEUE_MASK;
+    if ((int32_t)(events[previous].time - event.time) <= 0) {
+      break;
+    }
+    events[slot] = events[previous];
+    slot = previous;
+  }
+  events[slot] = event;
+  count++;
+  return true;
+}
+
+FASTRUN void EventQueue::pop(uint32_t now) {
+  EventSource& source = sources[events[head].source];
+  uint32_t latency = now - events[head].time;
+  source.dispatched++;
+  source.latencySum += latency;
+  if (latency > source.latencyMax) {
+    source.latencyMax = latency;
+  }
+  head = (head + 1) & EVENT_QUEUE_MASK;
+  count--;
+}
+
+uint32_t EventQueue::averageLatency(uint8_t source) const {
+  if (sources[source].dispatched == 0) {
+    return 0;
+  }
+  return sources[source].latencySum / sources[source].dispatched;
+}
@@ -0,0 +1,96 @@
+#include "Gate.h"
+#include "Placement.h"
+
+FLASHMEM void GateOutput::begin() {
+  seen = 0;
+  port = 0;
+  pendingPort = 0;
+  busy = false;
+  for (int i = 0; i < NUM_VOICES; i++) {
+    noteCount[i] = 0;
+    pulse[i] = 0;
+    pitchFrame[i] = 0;
+  }
+  opening = false;
+  skew.begin(GATE_LATE_US, GATE_SKEW_BUCKET_SHIFT);
+  early = 0;
+  writes = 0;
+  failed = 0;
+  retriggers = 0;
+  // Latches first, so the pins come up low when they turn into outputs
+  const uint8_t latches[3] = { MCP23017_OLATA, 0, 0 };
+  const uint8_t directions[3] = { MCP23017_IODIRA, 0, 0 };
+  i2cBus.write(I2C_PRIORITY_GATE, I2C_NO_MUX, GATE_MCP_ADDRESS, latches, 3);
+  i2cBus.write(I2C_PRIORITY_GATE, I2C_NO_MUX, GATE_MCP_ADDRESS, directions, 3);
+}
+
+FASTRUN void GateOutput::update(const Voice* voices, uint32_t gates, uint32_t cvFrame, I2cCallback done) {
+  uint32_t out = 0;
+  uint32_t active = gates;
+  while (active) {
+    int i = __builtin_ctz(active);
+    uint32_t bit = 1u << i;
+    active &= active - 1;
+    if (voices[i].noteCount != noteCount[i]) {
+      // New pitch, in the frame just handed to the CV output
+      noteCount[i] = voices[i].noteCount;
+      pitchFrame[i] = cvFrame;
+      if (seen & bit) {
+        pulse[i] = GATE_RETRIGGER_TICKS;
+        retriggers++;
+      }
+    }
+    if (pulse[i]) {
+      pulse[i]--;
+    } else if (seen & bit) {
+      out |= bit;
+    }
+  }
+  seen = gates;
+
+  if (out == port || busy) {
+    return;
+  }
+  uint8_t bytes[3] = { MCP23017_OLATA, (uint8_t)(out & 0xFF), (uint8_t)(out >> 8) };
+  uint32_t opened = out & ~port;
+  opening = opened != 0;
+  if (opening) {
+    // Skew of the write is that of the most recent pitch it opens
+    openingFrame = pitchFrame[__builtin_ctz(opened)];
+    while (opened) {
+      int i = __builtin_ctz(opened);
+      opened &= opened - 1;
+      if ((int32_t)(pitchFrame[i] - openingFrame) > 0) {
+        openingFrame = pitchFrame[i];
+      }
+    }
+  }
+  // Set before the write, its callback may run before write() returns
+  pendingPort = out;
+  busy = true;
+  if (i2cBus.write(I2C_PRIORITY_GATE, I2C_NO_MUX, GATE_MCP_ADDRESS, bytes, 3, done)) {
+    writes++;
+  } else {
+    busy = false;
+  }
+}
+
+FASTRUN void GateOutput::complete(bool ok, uint32_t now, bool pitchWritten, uint32_t pitchWrittenAt) {
+  if (ok) {
+    port = pendingPort;
+    if (opening) {
+      // A gate that beat its CV counts as no skew at all
+      int32_t us = pitchWritten ? (int32_t)(now - pitchWrittenAt) : 0;
+      if (us < 0) {
+        us = 0;
+      }
+      skew.record(us);
+      if (!pitchWritten || us < GATE_SETTLE_US) {
+        early++;
+      }
+    }
+  } else {
+    failed++;          // port unchanged, the next tick writes it again
+  }
+  busy = false;
+}
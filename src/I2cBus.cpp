@@ -0,0 +1,283 @@
+#include <string.h>
+#include "I2cBus.h"
+#include "Placement.h"
+
+#if defined(__IMXRT1062__)
+#include <Arduino.h>
+#include <Wire.h>
+#else
+uint32_t micros();   // supplied by the host harness
+#define __disable_irq()
+#define __enable_irq()
+#endif
+
+#define I2C_QUEUE_MASK (I2C_QUEUE_SIZE - 1)
+
+// LPI2C master transmit data commands (MTDR[10:8])
+#define LPI2C_CMD_TRANSMIT 0x0000
+#define LPI2C_CMD_RECEIVE 0x0100
+#define LPI2C_CMD_STOP 0x0200
+#define LPI2C_CMD_START 0x0400
+
+// LPI2C MSR flags, MIER uses the same bit positions
+#define LPI2C_FLAG_TDF (1 << 0)
+#define LPI2C_FLAG_RDF (1 << 1)
+#define LPI2C_FLAG_SDF (1 << 9)
+#define LPI2C_FLAG_NDF (1 << 10)
+#define LPI2C_FLAG_ALF (1 << 11)
+#define LPI2C_FLAG_FEF (1 << 12)
+#define LPI2C_FLAG_PLTF (1 << 13)
+#define LPI2C_FLAG_MBF (1 << 24)
+#define LPI2C_ERROR_FLAGS (LPI2C_FLAG_NDF | LPI2C_FLAG_ALF | LPI2C_FLAG_FEF | LPI2C_FLAG_PLTF)
+#define LPI2C_RDR_RXEMPTY (1 << 14)
+#define LPI2C_MCR_RTF (1 << 8)
+#define LPI2C_MCR_RRF (1 << 9)
+#define LPI2C_FIFO_DEPTH 4
+
+I2cBus i2cBus;
+
+static uint8_t activePriority;
+static uint8_t stopsTotal;
+static uint8_t stopsSeen;
+
+#if defined(__IMXRT1062__)
+static FASTRUN void lpi2cInterrupt() {
+  i2cBus.service();
+}
+#endif
+
+FLASHMEM void I2cBus::begin() {
+  for (int p = 0; p < I2C_PRIORITIES; p++) {
+    head[p] = 0;
+    tail[p] = 0;
+  }
+  active = 0;
+  busy = false;
+  erroring = false;
+  muxChannel = I2C_NO_MUX;
+  memset(&stats, 0, sizeof(stats));
+  stats.windowStart = micros();
+
+#if defined(__IMXRT1062__)
+  // Wire sets up pins and bus timing, after that the FIFO is driven from here
+  Wire.begin();
+  Wire.setClock(I2C_CLOCK);
+  LPI2C1_MIER = 0;
+  LPI2C1_MFCR = 1;   // TDF while at most one command is left in the FIFO
+  attachInterruptVector(IRQ_LPI2C1, lpi2cInterrupt);
+  NVIC_SET_PRIORITY(IRQ_LPI2C1, 96);
+  NVIC_ENABLE_IRQ(IRQ_LPI2C1);
+#endif
+}
+
+FASTRUN bool I2cBus::enqueue(uint8_t priority, const I2cTransaction& transaction) {
+  __disable_irq();
+  if ((uint8_t)(tail[priority] - head[priority]) >= I2C_QUEUE_SIZE) {
+    stats.dropped++;
+    __enable_irq();
+    return false;
+  }
+  I2cTransaction& slot = queue[priority][tail[priority] & I2C_QUEUE_MASK];
+  slot = transaction;
+  slot.queuedAt = micros();
+  tail[priority]++;
+  if (!busy) {
+    startNext();
+  }
+  __enable_irq();
+  return true;
+}
+
+FASTRUN bool I2cBus::write(uint8_t priority, uint8_t mux, uint8_t address, const uint8_t* bytes, uint8_t length, I2cCallback done) {
+  if (length > I2C_MAX_WRITE) {
+    return false;
+  }
+  I2cTransaction transaction;
+  transaction.address = address;
+  transaction.muxChannel = mux;
+  transaction.writeLength = length;
+  transaction.readLength = 0;
+  memcpy(transaction.data, bytes, length);
+  transaction.readBuffer = 0;
+  transaction.done = done;
+  return enqueue(priority, transaction);
+}
+
+FASTRUN bool I2cBus::readRegister(uint8_t priority, uint8_t mux, uint8_t address, uint8_t reg, uint8_t* buffer, uint8_t length, I2cCallback done) {
+  I2cTransaction transaction;
+  transaction.address = address;
+  transaction.muxChannel = mux;
+  transaction.writeLength = 1;
+  transaction.readLength = length;
+  transaction.data[0] = reg;
+  transaction.readBuffer = buffer;
+  transaction.done = done;
+  return enqueue(priority, transaction);
+}
+
+// ------------------------ Driver (interrupt context from here on)
+FASTRUN void I2cBus::startNext() {
+  active = 0;
+  for (uint8_t p = 0; p < I2C_PRIORITIES; p++) {
+    if (head[p] != tail[p]) {
+      active = &queue[p][head[p] & I2C_QUEUE_MASK];
+      activePriority = p;
+      break;
+    }
+  }
+  if (active == 0) {
+    busy = false;
+    return;
+  }
+  busy = true;
+  startedAt = micros();
+  uint32_t wait = startedAt - active->queuedAt;
+  stats.waitSum[activePriority] += wait;
+  stats.waitCount[activePriority]++;
+  if (wait > stats.waitMax[activePriority]) {
+    stats.waitMax[activePriority] = wait;
+  }
+  buildCommands();
+
+#if defined(__IMXRT1062__)
+  LPI2C1_MSR = LPI2C_ERROR_FLAGS | LPI2C_FLAG_SDF;
+  // TDF is set right away with an empty FIFO, so this enters service()
+  LPI2C1_MIER = LPI2C_FLAG_TDF | LPI2C_FLAG_RDF | LPI2C_FLAG_SDF | LPI2C_ERROR_FLAGS;
+#else
+  complete(true);
+#endif
+}
+
+FASTRUN void I2cBus::buildCommands() {
+  uint8_t n = 0;
+  stopsTotal = 0;
+  stopsSeen = 0;
+  commandIndex = 0;
+  readIndex = 0;
+
+  if (active->muxChannel != I2C_NO_MUX) {
+    if (active->muxChannel != muxChannel) {
+      // The TCA9548 switches on the STOP, so the select is its own transfer
+      commands[n++] = LPI2C_CMD_START | (I2C_MUX_ADDRESS << 1);
+      commands[n++] = LPI2C_CMD_TRANSMIT | (1 << active->muxChannel);
+      commands[n++] = LPI2C_CMD_STOP;
+      stopsTotal++;
+      muxChannel = active->muxChannel;
+      stats.muxSelects++;
+    } else {
+      stats.muxSkipped++;
+    }
+  }
+
+  commands[n++] = LPI2C_CMD_START | (active->address << 1);
+  for (uint8_t i = 0; i < active->writeLength; i++) {
+    commands[n++] = LPI2C_CMD_TRANSMIT | active->data[i];
+  }
+  if (active->readLength > 0) {
+    commands[n++] = LPI2C_CMD_START | (active->address << 1) | 1;
+    commands[n++] = LPI2C_CMD_RECEIVE | (active->readLength - 1);
+  }
+  commands[n++] = LPI2C_CMD_STOP;
+  stopsTotal++;
+  commandCount = n;
+}
+
+FASTRUN void I2cBus::complete(bool ok) {
+#if defined(__IMXRT1062__)
+  LPI2C1_MIER = 0;
+#endif
+  completedAt = micros();
+  stats.busyTime += completedAt - startedAt;
+  if (ok) {
+    stats.completed++;
+  } else {
+    stats.failed++;
+  }
+  if (active->done != 0) {
+    active->done(*active, ok);
+  }
+  // The slot is only handed back after the callback has seen it
+  head[activePriority]++;
+  startNext();
+}
+
+FASTRUN void I2cBus::service() {
+#if defined(__IMXRT1062__)
+  if (active == 0) {
+    LPI2C1_MIER = 0;
+    return;
+  }
+  uint32_t status = LPI2C1_MSR;
+
+  if (erroring) {
+    // Only SDF is enabled now: the STOP is out, or the bus was let go
+    LPI2C1_MSR = status & (LPI2C_ERROR_FLAGS | LPI2C_FLAG_SDF);
+    if ((status & LPI2C_FLAG_SDF) || !(status & LPI2C_FLAG_MBF)) {
+      erroring = false;
+      complete(false);
+    }
+    return;
+  }
+
+  if (status & LPI2C_ERROR_FLAGS) {
+    // NACK, lost arbitration or FIFO error: flush, release the bus and give
+    // up. With a STOP to send the failure waits for its SDF, which would
+    // otherwise be counted by the next transaction.
+    LPI2C1_MSR = status & (LPI2C_ERROR_FLAGS | LPI2C_FLAG_SDF);
+    LPI2C1_MCR |= LPI2C_MCR_RTF | LPI2C_MCR_RRF;
+    muxChannel = I2C_NO_MUX;
+    if (LPI2C1_MSR & LPI2C_FLAG_MBF) {
+      LPI2C1_MTDR = LPI2C_CMD_STOP;
+      erroring = true;
+      LPI2C1_MIER = LPI2C_FLAG_SDF;
+      return;
+    }
+    complete(false);
+    return;
+  }
+
+  while (readIndex < active->readLength) {
+    uint32_t received = LPI2C1_MRDR;
+    if (received & LPI2C_RDR_RXEMPTY) {
+      break;
+    }
+    active->readBuffer[readIndex++] = (uint8_t)received;
+  }
+
+  while (commandIndex < commandCount && (LPI2C1_MFSR & 7) < LPI2C_FIFO_DEPTH) {
+    LPI2C1_MTDR = commands[commandIndex++];
+  }
+  if (commandIndex == commandCount) {
+    LPI2C1_MIER &= ~LPI2C_FLAG_TDF;
+  }
+
+  if (status & LPI2C_FLAG_SDF) {
+    LPI2C1_MSR = LPI2C_FLAG_SDF;
+    stopsSeen++;
+    if (stopsSeen == stopsTotal && readIndex == active->readLength) {
+      complete(true);
+    }
+  }
+#endif
+}
+
+// ------------------------ Statistics
+uint32_t I2cBus::averageWait(uint8_t priority) const {
+  if (stats.waitCount[priority] == 0) {
+    return 0;
+  }
+  return stats.waitSum[priority] / stats.waitCount[priority];
+}
+
+void I2cBus::updateStats(uint32_t now) {
+  uint32_t window = now - stats.windowStart;
+  if (window < 1000000) {
+    return;
+  }
+  __disable_irq();
+  uint32_t busyTime = stats.busyTime;
+  stats.busyTime = 0;
+  __enable_irq();
+  stats.utilization = (uint16_t)((uint64_t)busyTime * 1000 / window);
+  stats.windowStart = now;
+}
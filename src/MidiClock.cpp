@@ -0,0 +1,128 @@
+#include "MidiClock.h"
+#include "Placement.h"
+
+static_assert((uint64_t)MIDI_CLOCK_PHASE_PER_TICK * MIDI_CLOCK_PPQN <= 0xFFFFFFFFull, "a beat of phase must not wrap");
+
+void MidiClock::reset() {
+  running = false;
+  locked = false;
+  acquireTicks = 0;
+  startPending = false;
+  tickInBeat = 0;
+  beatCount = 0;
+  lastRawTick = 0;
+  tickTimeQ8 = 0;
+  periodQ8 = (uint32_t)MIDI_CLOCK_DEFAULT_PERIOD << 8;
+  phasePerUs = MIDI_CLOCK_PHASE_PER_TICK / MIDI_CLOCK_DEFAULT_PERIOD;
+  lastErrorQ8 = 0;
+  ticksReceived = 0;
+  reseeds = 0;
+}
+
+static FASTRUN uint32_t clampPeriod(uint32_t period) {
+  if (period < MIDI_CLOCK_MIN_PERIOD) {
+    return MIDI_CLOCK_MIN_PERIOD;
+  }
+  if (period > MIDI_CLOCK_MAX_PERIOD) {
+    return MIDI_CLOCK_MAX_PERIOD;
+  }
+  return period;
+}
+
+// ------------------------ Clock tick (ingest path, constant time)
+FASTRUN void MidiClock::tick(uint32_t now) {
+  uint32_t nowQ8 = now << 8;
+  if (ticksReceived > 0) {
+    uint32_t predictedQ8 = tickTimeQ8 + periodQ8;
+    int32_t errorQ8 = (int32_t)(nowQ8 - predictedQ8);
+    int32_t capture = (int32_t)MIDI_CLOCK_CAPTURE_US << 8;
+    if (locked && errorQ8 < capture && errorQ8 > -capture) {
+      // Loop filter: pull the tick time by b * error, the period by c * error.
+      // Wide gains right after a re-seed, narrow ones once settled.
+      bool acquiring = acquireTicks > 0;
+      if (acquiring) {
+        acquireTicks--;
+      }
+      tickTimeQ8 = predictedQ8 + (uint32_t)(errorQ8 >> (acquiring ? MIDI_CLOCK_ACQUIRE_GAIN_B : MIDI_CLOCK_GAIN_B));
+      periodQ8 += (uint32_t)(errorQ8 >> (acquiring ? MIDI_CLOCK_ACQUIRE_GAIN_C : MIDI_CLOCK_GAIN_C));
+      if (clampPeriod(periodQ8 >> 8) != (periodQ8 >> 8)) {
+        periodQ8 = clampPeriod(periodQ8 >> 8) << 8;
+      }
+      lastErrorQ8 = errorQ8;
+    } else {
+      // Not tracking yet, or lost: restart from the raw interval
+      periodQ8 = clampPeriod(now - lastRawTick) << 8;
+      tickTimeQ8 = nowQ8;
+      lastErrorQ8 = 0;
+      locked = true;
+      acquireTicks = MIDI_CLOCK_ACQUIRE_TICKS;
+      reseeds++;
+    }
+    phasePerUs = MIDI_CLOCK_PHASE_PER_TICK / (periodQ8 >> 8);
+  } else {
+    tickTimeQ8 = nowQ8;
+  }
+  lastRawTick = now;
+  ticksReceived++;
+
+  if (startPending) {
+    // First clock after Start is the downbeat
+    startPending = false;
+    running = true;
+    tickInBeat = 0;
+    beatCount = 0;
+  } else if (running) {
+    tickInBeat++;
+    if (tickInBeat >= MIDI_CLOCK_PPQN) {
+      tickInBeat = 0;
+      beatCount++;
+    }
+  }
+}
+
+void MidiClock::start(uint32_t now) {
+  (void)now;
+  startPending = true;
+  tickInBeat = 0;
+  beatCount = 0;
+}
+
+void MidiClock::cont(uint32_t now) {
+  (void)now;
+  running = true;
+}
+
+void MidiClock::stop() {
+  running = false;
+  startPending = false;
+}
+
+FASTRUN void MidiClock::poll(uint32_t now) {
+  if (locked && now - lastRawTick > MIDI_CLOCK_TIMEOUT_TICKS * (periodQ8 >> 8)) {
+    locked = false;
+    running = false;
+  }
+}
+
+FASTRUN uint32_t MidiClock::phase(uint32_t now) const {
+  uint32_t base = tickInBeat * MIDI_CLOCK_PHASE_PER_TICK;
+  if (!running || !locked) {
+    return base;
+  }
+  int32_t elapsedQ8 = (int32_t)((now << 8) - tickTimeQ8);
+  if (elapsedQ8 <= 0) {
+    return base;
+  }
+  uint32_t period = periodQ8 >> 8;
+  uint32_t elapsed = (uint32_t)elapsedQ8 >> 8;
+  if (elapsed >= period || (now - lastRawTick) >= 2 * period) {
+    return base + MIDI_CLOCK_PHASE_PER_TICK - 1;
+  }
+  // phasePerUs is rounded down, so this stays inside the tick
+  return base + elapsed * phasePerUs;
+}
+
+uint16_t MidiClock::tempo() const {
+  // 60e6 µs/min * 100 / 24 ticks per beat
+  return (uint16_t)(250000000u / (periodQ8 >> 8));
+}
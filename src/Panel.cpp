@@ -0,0 +1,57 @@
+#include "Panel.h"
+
+void Panel::begin(uint16_t initial, uint32_t now) {
+  raw = initial;
+  stable = initial;
+  for (int i = 0; i < PANEL_INPUTS; i++) {
+    changeTime[i] = now;
+  }
+  reads = 0;
+  readsPerSecond = 0;
+  windowStart = now;
+  windowReads = 0;
+}
+
+void Panel::sample(uint16_t value, uint32_t now) {
+  reads++;
+  windowReads++;
+  uint16_t moved = value ^ raw;
+  raw = value;
+  // Every edge, bounce included, restarts that input's stable interval
+  while (moved) {
+    int bit = __builtin_ctz(moved);
+    changeTime[bit] = now;
+    moved &= moved - 1;
+  }
+}
+
+uint16_t Panel::update(uint32_t now, EventQueue& queue) {
+  if (now - windowStart >= 1000000) {
+    readsPerSecond = windowReads;
+    windowReads = 0;
+    windowStart = now;
+  }
+
+  uint16_t changed = 0;
+  uint16_t pending = raw ^ stable;
+  while (pending) {
+    int bit = __builtin_ctz(pending);
+    pending &= pending - 1;
+    if (now - changeTime[bit] < PANEL_DEBOUNCE_US) {
+      continue;
+    }
+    uint16_t mask = (uint16_t)(1u << bit);
+    stable ^= mask;
+    changed |= mask;
+
+    MidiEvent event;
+    event.time = changeTime[bit];
+    event.source = EVENT_SOURCE_PANEL;
+    event.type = EVENT_TYPE_PANEL;
+    event.channel = 1;
+    event.data1 = (uint8_t)bit;
+    event.data2 = (stable & mask) ? 1 : 0;
+    queue.push(event);
+  }
+  return changed;
+}
@@ -0,0 +1,234 @@
+#include "Player.h"
+#include "Placement.h"
+
+Sequence sequence;
+
+FLASHMEM void sequenceDefaults() {
+  // One bar of sixteenths, root, octave, fifth, seventh
+  const uint8_t notes[4] = { 36, 48, 43, 46 };
+  sequence.length = 16;
+  for (int i = 0; i < 3; i++) {
+    sequence.reserved[i] = 0;
+  }
+  for (int i = 0; i < SEQUENCE_STEPS; i++) {
+    sequence.steps[i].note = notes[i % 4];
+    sequence.steps[i].velocity = 100;
+    sequence.steps[i].gateLength = 0;
+    sequence.steps[i].reserved = 0;
+  }
+}
+
+// ------------------------ Held keys
+bool HeldNotes::add(uint8_t note, uint8_t noteVelocity) {
+  for (int i = 0; i < count; i++) {
+    if (sorted[i] == note) {
+      velocity[note] = noteVelocity;
+      return true;
+    }
+  }
+  if (count >= ARP_MAX_NOTES) {
+    return false;
+  }
+  int i = count;
+  while (i > 0 && sorted[i - 1] > note) {
+    sorted[i] = sorted[i - 1];
+    i--;
+  }
+  sorted[i] = note;
+  played[count] = note;
+  velocity[note] = noteVelocity;
+  count++;
+  return true;
+}
+
+void HeldNotes::remove(uint8_t note) {
+  int i = 0;
+  while (i < count && sorted[i] != note) {
+    i++;
+  }
+  if (i == count) {
+    return;                    // not held
+  }
+  for (; i + 1 < count; i++) {
+    sorted[i] = sorted[i + 1];
+  }
+  i = 0;
+  while (played[i] != note) {
+    i++;
+  }
+  for (; i + 1 < count; i++) {
+    played[i] = played[i + 1];
+  }
+  count--;
+}
+
+// ------------------------ Arpeggiator
+void Arpeggiator::reset() {
+  index = 0;
+  octave = 0;
+  random = 0x2545F491;
+  key = 0;
+}
+
+FASTRUN uint8_t Arpeggiator::next(const HeldNotes& held, uint8_t pattern, uint8_t octaves) {
+  if (held.count == 0) {
+    return NO_NOTE;
+  }
+  if (octaves < 1) {
+    octaves = 1;
+  }
+  uint8_t note;
+  if (pattern == ARP_RANDOM) {
+    random ^= random << 13;
+    random ^= random >> 17;
+    random ^= random << 5;
+    key = held.sorted[random % held.count];
+    note = key + 12 * ((random >> 8) % octaves);
+  } else {
+    // Keys released since the last step can leave index past the end
+    if (index >= held.count) {
+      index = 0;
+      octave = (octave + 1) % octaves;
+    }
+    if (octave >= octaves) {
+      octave = 0;
+    }
+    if (pattern == ARP_DOWN) {
+      key = held.sorted[held.count - 1 - index];
+    } else if (pattern == ARP_AS_PLAYED) {
+      key = held.played[index];
+    } else {
+      key = held.sorted[index];
+    }
+    uint8_t shift = pattern == ARP_DOWN ? octaves - 1 - octave : octave;
+    note = key + 12 * shift;
+    if (++index >= held.count) {
+      index = 0;
+      octave = (octave + 1) % octaves;
+    }
+  }
+  while (note > 127) {
+    note -= 12;
+  }
+  return note;
+}
+
+// ------------------------ Player
+void Player::begin() {
+  held.clear();
+  arp.reset();
+  internalPosition = 0;
+  stepValid = false;
+  lastStep = 0;
+  mode = PLAY_MODE_LIVE;
+  playing = NO_NOTE;
+  offAt = 0;
+  eventCount = 0;
+  steps = 0;
+}
+
+void Player::keyEvent(const MidiEvent& event) {
+  if (event.type == EVENT_TYPE_NOTE_ON) {
+    if (held.count == 0) {
+      arp.reset();             // a new chord starts at the first key
+    }
+    held.add(event.data1, event.data2);
+  } else if (event.type == EVENT_TYPE_NOTE_OFF) {
+    held.remove(event.data1);
+  }
+}
+
+void Player::emit(uint8_t type, uint8_t note, uint8_t velocity, uint32_t now) {
+  if (eventCount >= PLAYER_MAX_EVENTS) {
+    return;
+  }
+  MidiEvent& event = events[eventCount++];
+  event.time = now;
+  event.source = EVENT_SOURCE_PLAYER;
+  event.type = type;
+  event.channel = 1;
+  event.data1 = note;
+  event.data2 = velocity;
+}
+
+void Player::release(uint32_t now) {
+  if (playing != NO_NOTE) {
+    emit(EVENT_TYPE_NOTE_OFF, playing, 0, now);
+    playing = NO_NOTE;
+  }
+}
+
+FASTRUN uint8_t Player::tick(const Patch& patch, const MidiClock& clock, uint32_t now, uint32_t tickUs) {
+  eventCount = 0;
+  if (patch.playMode != mode) {
+    release(now);
+    mode = patch.playMode;
+    stepValid = false;
+    held.clear();
+    arp.reset();
+  }
+  if (mode == PLAY_MODE_LIVE) {
+    return eventCount;
+  }
+
+  // ------------------ Transport: beats << 32
+  uint64_t position;
+  if (clock.locked) {
+    if (!clock.running) {
+      release(now);
+      stepValid = false;
+      return eventCount;
+    }
+    position = ((uint64_t)clock.beatCount << 32) + clock.phase(now);
+  } else {
+    // 1/100 BPM to beats << 32 per tick
+    internalPosition += ((uint64_t)patch.internalTempo << 32) * tickUs / 6000000000ull;
+    position = internalPosition;
+  }
+
+  uint8_t perBeat = patch.stepsPerBeat ? patch.stepsPerBeat : 1;
+  uint32_t step = (uint32_t)((position * perBeat) >> 32);
+  uint64_t stepLength = (1ull << 32) / perBeat;
+
+  // ------------------ Gate end inside the step
+  if (playing != NO_NOTE && position >= offAt) {
+    release(now);
+  }
+  if (stepValid && step == lastStep) {
+    return eventCount;
+  }
+  stepValid = true;
+  lastStep = step;
+  steps++;
+
+  // ------------------ New step
+  uint8_t note = NO_NOTE;
+  uint8_t velocity = 0;
+  uint8_t gate = patch.gateLength;
+  if (mode == PLAY_MODE_ARP) {
+    note = arp.next(held, patch.arpPattern, patch.arpOctaves);
+    velocity = held.velocity[arp.key];
+  } else {
+    uint8_t length = sequence.length >= 1 && sequence.length <= SEQUENCE_STEPS ? sequence.length : SEQUENCE_STEPS;
+    const SequenceStep& s = sequence.steps[step % length];
+    if (s.velocity > 0) {
+      note = s.note & 0x7F;
+      velocity = s.velocity & 0x7F;
+      if (s.gateLength) {
+        gate = s.gateLength;
+      }
+    }
+  }
+  release(now);
+  if (note != NO_NOTE) {
+    if (gate < 1 || gate > 8) {
+      gate = 8;
+    }
+    uint64_t stepStart = (uint64_t)step * stepLength;
+    // A full-length gate still closes just before the next step
+    offAt = stepStart + stepLength * gate / 8 - (gate == 8 ? 1 : 0);
+    emit(EVENT_TYPE_NOTE_ON, note, velocity, now);
+    playing = note;
+  }
+  return eventCount;
+}
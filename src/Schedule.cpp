@@ -0,0 +1,79 @@
+#include "Schedule.h"
+#include "Placement.h"
+
+void OutputSchedule::begin(uint32_t latencyUs) {
+  staged = false;
+  armed = false;
+  committed = false;
+  late = 0;
+  setLatency(latencyUs);
+  beginOnset();
+}
+
+// Histogram budget and bucket width follow the latency
+void OutputSchedule::beginOnset() {
+  // Wide enough for the latency plus a control period and a loop pass
+  uint8_t shift = ONSET_BUCKET_SHIFT;
+  while (((latency + 2000) >> shift) >= BUDGET_BUCKETS) {
+    shift++;
+  }
+  onset.begin(latency + SCHEDULE_AHEAD_US, shift);
+  bestOnset = 0xFFFFFFFF;
+}
+
+void OutputSchedule::setLatency(uint32_t latencyUs) {
+  latency = latencyUs > SCHEDULE_MAX_LATENCY_US ? SCHEDULE_MAX_LATENCY_US : latencyUs;
+  // Onsets at the old latency are not comparable. A staged batch still
+  // records from the commit timer, so the histogram restarts after it.
+  if (!staged && onset.budget != latency + SCHEDULE_AHEAD_US) {
+    beginOnset();
+  }
+}
+
+FASTRUN bool OutputSchedule::take(const MidiEvent& event, uint32_t now) {
+  uint32_t due = event.time + latency;
+  if (armed) {
+    return false;
+  }
+  if (staged) {
+    return (int32_t)(due - dueTime) <= SCHEDULE_MERGE_US;
+  }
+  if ((int32_t)(due - now) > SCHEDULE_AHEAD_US) {
+    return false;
+  }
+  staged = true;
+  dueTime = due;
+  firstEvent = event.time;
+  return true;
+}
+
+FASTRUN int32_t OutputSchedule::arm(uint32_t now) {
+  armed = true;
+  int32_t wait = (int32_t)(dueTime - now);
+  if (wait <= 0) {
+    late++;
+  }
+  return wait;
+}
+
+FASTRUN void OutputSchedule::commit(uint32_t now) {
+  recordOnset(now - firstEvent);
+  committed = true;
+}
+
+FASTRUN bool OutputSchedule::adopt() {
+  if (!committed) {
+    return false;
+  }
+  staged = false;
+  armed = false;
+  committed = false;
+  return true;
+}
+
+FASTRUN void OutputSchedule::recordOnset(uint32_t latencyUs) {
+  onset.record(latencyUs);
+  if (latencyUs < bestOnset) {
+    bestOnset = latencyUs;
+  }
+}
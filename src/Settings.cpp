@@ -0,0 +1,53 @@
+#include "Settings.h"
+#include "Placement.h"
+#include "Schedule.h"
+
+Patch patch;
+Calibration calibration;
+
+FLASHMEM void patchDefaults() {
+  patch.pitchBendRange = DEFAULT_PITCH_BEND_RANGE;
+  patch.lfoDepthCents = DEFAULT_LFO_DEPTH_CENTS;
+  patch.detune = 0;
+  patch.cvLfoDepth = 0;
+  patch.outputLatency = DEFAULT_OUTPUT_LATENCY_US;
+  patch.playMode = PLAY_MODE_LIVE;
+  patch.arpPattern = ARP_UP;
+  patch.arpOctaves = 1;
+  patch.stepsPerBeat = 4;
+  patch.gateLength = 4;
+  patch.reserved2 = 0;
+  patch.internalTempo = DEFAULT_INTERNAL_TEMPO;
+  patch.keyMode = KEY_MODE_POLY;
+  patch.keyPriority = KEY_PRIORITY_LAST;
+  patch.glideTime = DEFAULT_GLIDE_TIME;
+}
+
+static uint16_t clampField(uint16_t value, uint16_t low, uint16_t high) {
+  return value < low ? low : value > high ? high : value;
+}
+
+FLASHMEM void patchValidate() {
+  if (patch.playMode > PLAY_MODE_SEQUENCE) {
+    patch.playMode = PLAY_MODE_LIVE;
+  }
+  if (patch.arpPattern > ARP_AS_PLAYED) {
+    patch.arpPattern = ARP_UP;
+  }
+  if (patch.keyMode > KEY_MODE_LEGATO) {
+    patch.keyMode = KEY_MODE_POLY;
+  }
+  if (patch.keyPriority > KEY_PRIORITY_HIGH) {
+    patch.keyPriority = KEY_PRIORITY_LAST;
+  }
+  patch.arpOctaves = (uint8_t)clampField(patch.arpOctaves, 1, 4);
+  patch.stepsPerBeat = (uint8_t)clampField(patch.stepsPerBeat, 1, STEPS_PER_BEAT_MAX);
+  patch.gateLength = (uint8_t)clampField(patch.gateLength, 1, 8);
+  patch.outputLatency = clampField(patch.outputLatency, 0, SCHEDULE_MAX_LATENCY_US);
+  patch.internalTempo = clampField(patch.internalTempo, INTERNAL_TEMPO_MIN, INTERNAL_TEMPO_MAX);
+  patch.reserved2 = 0;
+}
+
+FLASHMEM void calibrationDefaults() {
+  calibrationDefaults(calibration);
+}
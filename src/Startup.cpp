@@ -0,0 +1,30 @@
+#include "Startup.h"
+#include "Placement.h"
+
+FLASHMEM void Startup::begin(uint8_t voices) {
+  listening = 0;
+  firstVoice = 0;
+  allVoices = 0;
+  firstNote = 0;
+  voiceMask = 0;
+  absentMask = 0;
+  fullMask = voices < 32 ? (1u << voices) - 1 : 0xFFFFFFFF;
+  notesMasked = 0;
+}
+
+bool Startup::voicesReady(uint32_t mask, uint32_t absent, uint32_t now) {
+  mask &= fullMask;
+  absent &= fullMask & ~mask;
+  if (mask == voiceMask && absent == absentMask) {
+    return false;
+  }
+  if (voiceMask == 0 && mask != 0) {
+    firstVoice = now;
+  }
+  voiceMask = mask;
+  absentMask = absent;
+  if (complete()) {
+    allVoices = now;
+  }
+  return true;
+}
@@ -0,0 +1,165 @@
+#include "SysEx.h"
+
+void SysExStream::begin(const SysExBlock* blockTable, uint8_t count) {
+  blocks = blockTable;
+  numBlocks = count;
+  rxBlock = 0;
+  rxOffset = 0;
+  rxSum = 0;
+  rxErrors = 0;
+  blocksLoaded = 0;
+  txBlock = 0;
+  txOffset = 0;
+  txSum = 0;
+  txAll = false;
+}
+
+const SysExBlock* SysExStream::findBlock(uint8_t id) const {
+  for (int i = 0; i < numBlocks; i++) {
+    if (blocks[i].id == id) {
+      return &blocks[i];
+    }
+  }
+  return 0;
+}
+
+void SysExStream::abortReceive() {
+  if (rxBlock != 0) {
+    rxBlock->defaults();
+    rxErrors++;
+    rxBlock = 0;
+  }
+}
+
+// ------------------------ Receive: decode each chunk into the destination
+void SysExStream::receive(const uint8_t* msg, unsigned len) {
+  if (len < 6 || msg[0] != 0xF0 || msg[1] != SYSEX_MANUFACTURER || msg[2] != SYSEX_DEVICE || msg[len - 1] != 0xF7) {
+    return;
+  }
+
+  if (msg[3] == SYSEX_CMD_REQUEST) {
+    requestDump(msg[4]);
+    return;
+  }
+
+  if (len < SYSEX_FRAME_BYTES) {
+    abortReceive();
+    return;
+  }
+  const SysExBlock* block = findBlock(msg[4]);
+  uint16_t offset = (uint16_t)(msg[5] << 7 | msg[6]);
+
+  if (msg[3] == SYSEX_CMD_DATA) {
+    if (block == 0) {
+      return;
+    }
+    if (offset == 0) {
+      abortReceive();
+      rxBlock = block;
+      rxOffset = 0;
+      rxSum = 0;
+    } else if (rxBlock != block || offset != rxOffset) {
+      abortReceive();
+      return;
+    }
+    const uint8_t* p = msg + 7;
+    const uint8_t* end = msg + len - 2;
+    uint8_t chunkSum = 0;
+    while (p < end) {
+      uint8_t msbs = *p++;
+      chunkSum += msbs;
+      for (int b = 0; b < 7 && p < end; b++) {
+        if (rxOffset >= block->size) {
+          abortReceive();
+          return;
+        }
+        chunkSum += *p;
+        block->data[rxOffset++] = (uint8_t)(*p++ | (((msbs >> b) & 1) << 7));
+      }
+    }
+    if (((chunkSum + *end) & 0x7F) != 0) {
+      abortReceive();
+      return;
+    }
+    rxSum += chunkSum;
+  }
+
+  if (msg[3] == SYSEX_CMD_END) {
+    if (rxBlock == 0) {
+      return;
+    }
+    if (rxBlock != block || offset != block->size || rxOffset != block->size || ((rxSum + msg[7]) & 0x7F) != 0) {
+      abortReceive();
+      return;
+    }
+    blocksLoaded++;
+    if (rxBlock->loaded != 0) {
+      rxBlock->loaded();
+    }
+    rxBlock = 0;
+  }
+}
+
+// ------------------------ Transmit: one message per call
+void SysExStream::requestDump(uint8_t blockId) {
+  if (numBlocks == 0) {
+    return;
+  }
+  txAll = blockId == SYSEX_ALL_BLOCKS;
+  txBlock = txAll ? &blocks[0] : findBlock(blockId);
+  txOffset = 0;
+  txSum = 0;
+}
+
+unsigned SysExStream::nextMessage(uint8_t* out) {
+  if (txBlock == 0) {
+    return 0;
+  }
+  unsigned n = 0;
+  out[n++] = 0xF0;
+  out[n++] = SYSEX_MANUFACTURER;
+  out[n++] = SYSEX_DEVICE;
+
+  if (txOffset < txBlock->size) {
+    out[n++] = SYSEX_CMD_DATA;
+    out[n++] = txBlock->id;
+    out[n++] = (txOffset >> 7) & 0x7F;
+    out[n++] = txOffset & 0x7F;
+    uint16_t end = txOffset + SYSEX_CHUNK_BYTES;
+    if (end > txBlock->size) {
+      end = txBlock->size;
+    }
+    uint8_t chunkSum = 0;
+    while (txOffset < end) {
+      uint8_t* msbs = &out[n++];
+      *msbs = 0;
+      for (int b = 0; b < 7 && txOffset < end; b++) {
+        uint8_t value = txBlock->data[txOffset++];
+        *msbs |= (uint8_t)((value >> 7) << b);
+        out[n++] = value & 0x7F;
+        chunkSum += value & 0x7F;
+      }
+      chunkSum += *msbs;
+    }
+    out[n++] = (uint8_t)(-chunkSum) & 0x7F;
+    out[n++] = 0xF7;
+    txSum += chunkSum;
+    return n;
+  }
+
+  out[n++] = SYSEX_CMD_END;
+  out[n++] = txBlock->id;
+  out[n++] = (txBlock->size >> 7) & 0x7F;
+  out[n++] = txBlock->size & 0x7F;
+  out[n++] = (uint8_t)(-txSum) & 0x7F;
+  out[n++] = 0xF7;
+
+  if (txAll && txBlock + 1 < blocks + numBlocks) {
+    txBlock++;
+  } else {
+    txBlock = 0;
+  }
+  txOffset = 0;
+  txSum = 0;
+  return n;
+}
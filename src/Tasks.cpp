@@ -0,0 +1,52 @@
+#include "Tasks.h"
+#include "Placement.h"
+
+void TaskScheduler::begin(const Task* taskTable, TaskStats* taskStats, uint8_t taskCount, uint32_t (*cycleCounter)(), uint32_t cyclesPerUs, uint32_t now) {
+  tasks = taskTable;
+  stats = taskStats;
+  count = taskCount;
+  cycles = cycleCounter;
+  sliceCycles = TASK_SLICE_US * cyclesPerUs;
+  for (int i = 0; i < count; i++) {
+    stats[i].calls = 0;
+    stats[i].worked = 0;
+    stats[i].cycles = 0;
+    stats[i].worst = 0;
+    stats[i].lastRun = now - tasks[i].period;   // due on the first pass
+    stats[i].deferred = 0;
+  }
+}
+
+FASTRUN uint32_t TaskScheduler::run(uint32_t now, uint8_t degradeLevel) {
+  uint32_t passStart = cycles();
+  uint32_t worked = 0;
+  for (int i = 0; i < count; i++) {
+    const Task& task = tasks[i];
+    TaskStats& s = stats[i];
+    if (degradeLevel > task.maxDegrade || now - s.lastRun < task.period) {
+      continue;
+    }
+    uint32_t start = cycles();
+    if (task.priority >= TASK_BACKGROUND && start - passStart >= sliceCycles) {
+      s.deferred++;
+      continue;
+    }
+    bool didWork = task.run();
+    uint32_t spent = cycles() - start;
+    s.lastRun = now;
+    s.calls++;
+    s.cycles += spent;
+    if (spent > s.worst) {
+      s.worst = spent;
+    }
+    if (didWork) {
+      s.worked++;
+      worked |= 1u << i;
+    }
+  }
+  return worked;
+}
+
+uint32_t TaskScheduler::averageCycles(uint8_t task) const {
+  return stats[task].calls ? (uint32_t)(stats[task].cycles / stats[task].calls) : 0;
+}
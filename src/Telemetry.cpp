@@ -0,0 +1,196 @@
+#include "Telemetry.h"
+#include "CvOutput.h"
+#include "Placement.h"
+
+static_assert(1 + NUM_VOICES * 9 <= TELEMETRY_MAX_PAYLOAD, "voice snapshot must fit a frame");
+static_assert(1 + TELEMETRY_COUNTERS_COUNT * 4 <= TELEMETRY_MAX_PAYLOAD, "all counters must fit a frame");
+static_assert(TELEMETRY_MAX_TRACE <= TRACE_SIZE, "a trace frame only holds stored entries");
+
+void Telemetry::begin(uint16_t permille, uint32_t nowCycles) {
+  rawLength = 0;
+  sequence = 0;
+  cpuPermille = permille;
+  credit = 0;
+  lastCycles = nowCycles;
+  sent = 0;
+  dropped = 0;
+}
+
+FASTRUN bool Telemetry::allowed(uint32_t nowCycles) {
+  uint32_t elapsed = nowCycles - lastCycles;
+  lastCycles = nowCycles;
+  int64_t refilled = (int64_t)credit + (int64_t)elapsed * cpuPermille / 1000;
+  credit = refilled > TELEMETRY_BURST_CYCLES ? TELEMETRY_BURST_CYCLES : (int32_t)refilled;
+  return credit > 0;
+}
+
+// ------------------------ Frame building
+void Telemetry::start(uint8_t type, uint32_t now) {
+  rawLength = 0;
+  put8(type);
+  put8(sequence++);
+  put32(now);
+}
+
+void Telemetry::put16(uint16_t value) {
+  put8(value & 0xFF);
+  put8(value >> 8);
+}
+
+void Telemetry::put32(uint32_t value) {
+  put16(value & 0xFFFF);
+  put16(value >> 16);
+}
+
+uint16_t Telemetry::finish() {
+  put16(telemetryCrc(raw, rawLength));
+  // COBS: every zero becomes the distance to the next one
+  uint16_t out = 1;
+  uint16_t code = 0;
+  uint8_t run = 1;
+  for (uint16_t i = 0; i < rawLength; i++) {
+    if (raw[i] == 0) {
+      frame[code] = run;
+      code = out++;
+      run = 1;
+    } else {
+      frame[out++] = raw[i];
+      if (++run == 0xFF) {
+        frame[code] = run;
+        code = out++;
+        run = 1;
+      }
+    }
+  }
+  frame[code] = run;
+  frame[out++] = 0;
+  return out;
+}
+
+uint16_t Telemetry::voices(const VoiceEngine& engine, uint32_t now) {
+  start(TELEMETRY_VOICES, now);
+  put8(NUM_VOICES);
+  for (int i = 0; i < NUM_VOICES; i++) {
+    const Voice& v = engine.voices[i];
+    uint8_t flags = 0;
+    if (v.noteOn) {
+      flags |= TELEMETRY_VOICE_FLAG_ON;
+    }
+    if (v.keyDown) {
+      flags |= TELEMETRY_VOICE_FLAG_KEY_DOWN;
+    }
+    if (v.sustained) {
+      flags |= TELEMETRY_VOICE_FLAG_SUSTAINED;
+    }
+    if (engine.gates & (1u << i)) {
+      flags |= TELEMETRY_VOICE_FLAG_GATE;
+    }
+    put8(v.midiNote);
+    put8(flags);
+    put16(v.bentNoteVolts);
+    put32(ad9833Word(v.bentFrequency));
+    put8(v.pressure >> 8);
+  }
+  return finish();
+}
+
+uint16_t Telemetry::counters(const uint32_t* values, uint8_t count, uint32_t now) {
+  start(TELEMETRY_COUNTERS, now);
+  put8(count);
+  for (int i = 0; i < count; i++) {
+    put32(values[i]);
+  }
+  return finish();
+}
+
+uint16_t Telemetry::histogram(uint8_t id, const BudgetMonitor& monitor, uint32_t now) {
+  start(TELEMETRY_HISTOGRAM, now);
+  put8(id);
+  put8(monitor.bucketShift);
+  put32(monitor.count);
+  put32(monitor.worst);
+  put32(monitor.overruns);
+  // Only the used range of buckets
+  int first = 0;
+  int last = BUDGET_BUCKETS - 1;
+  while (first < BUDGET_BUCKETS && monitor.histogram[first] == 0) {
+    first++;
+  }
+  while (last >= first && monitor.histogram[last] == 0) {
+    last--;
+  }
+  put8(first);
+  put8(last - first + 1);
+  for (int i = first; i <= last; i++) {
+    put32(monitor.histogram[i]);
+  }
+  return finish();
+}
+
+// ------------------------ CRC and decoding (host side too)
+uint16_t telemetryCrc(const uint8_t* data, uint16_t length) {
+  uint16_t crc = 0xFFFF;
+  for (uint16_t i = 0; i < length; i++) {
+    crc ^= (uint16_t)data[i] << 8;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+uint16_t telemetryDecode(const uint8_t* in, uint16_t length, uint8_t* out) {
+  uint16_t decoded = 0;
+  uint16_t i = 0;
+  while (i < length) {
+    uint8_t code = in[i++];
+    if (code == 0 || i + code - 1 > length) {
+      return 0;
+    }
+    for (int n = 1; n < code; n++) {
+      out[decoded++] = in[i++];
+    }
+    if (code != 0xFF && i < length) {
+      out[decoded++] = 0;
+    }
+  }
+  if (decoded < 8 || telemetryCrc(out, decoded - 2) != (uint16_t)(out[decoded - 2] | out[decoded - 1] << 8)) {
+    return 0;
+  }
+  return decoded - 2;
+}
+
+uint16_t Telemetry::tasks(const TaskScheduler& scheduler, uint32_t now) {
+  start(TELEMETRY_TASKS, now);
+  uint8_t count = scheduler.count < TELEMETRY_MAX_TASKS ? scheduler.count : TELEMETRY_MAX_TASKS;
+  put8(count);
+  for (int i = 0; i < count; i++) {
+    const TaskStats& s = scheduler.stats[i];
+    put32(s.calls);
+    put32(s.worked);
+    put32(scheduler.averageCycles(i));
+    put32(s.worst);
+    put32(s.deferred);
+  }
+  return finish();
+}
+
+uint16_t Telemetry::trace(const TraceBuffer& buffer, uint32_t since, uint32_t now) {
+  start(TELEMETRY_TRACE, now);
+  put32(buffer.total);
+  uint32_t count = buffer.total - since;
+  if (count > TELEMETRY_MAX_TRACE) {
+    count = TELEMETRY_MAX_TRACE;
+  }
+  put8(count);
+  TraceEntry entry;
+  for (uint32_t n = count; n-- > 0;) {
+    buffer.get(n, entry);
+    put32(entry.time);
+    put8(entry.event);
+    put8(entry.work);
+    put16(entry.count);
+    put32(entry.value);
+  }
+  return finish();
+}
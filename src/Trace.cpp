@@ -0,0 +1,22 @@
+#include "Trace.h"
+#include "Placement.h"
+
+TraceBuffer trace;
+
+FASTRUN void TraceBuffer::log(uint32_t time, uint8_t event, uint8_t work, uint16_t count, uint32_t value) {
+  TraceEntry& entry = entries[total & (TRACE_SIZE - 1)];
+  entry.time = time;
+  entry.event = event;
+  entry.work = work;
+  entry.count = count;
+  entry.value = value;
+  total++;
+}
+
+bool TraceBuffer::get(uint32_t n, TraceEntry& entry) const {
+  if (n >= total || n >= TRACE_SIZE) {
+    return false;
+  }
+  entry = entries[(total - 1 - n) & (TRACE_SIZE - 1)];
+  return true;
+}
@@ -0,0 +1,247 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Tuning.h"
+#include "Placement.h"
+
+// ----------------------------- MIDI note frequencies C1-C7
+const float noteFrequency[EQUAL_NOTES] PROGMEM = {
+  32.7032, 34.6478, 36.7081, 38.8909, 41.2034, 43.6535, 46.2493, 48.9994, 51.9131, 55, 58.2705, 61.7354, 
+  65.4064, 69.2957, 73.4162, 77.7817, 82.4069, 87.3071, 92.4986, 97.9989, 103.826, 110, 116.541, 123.471, 
+  130.813, 138.591, 146.832, 155.563, 164.814, 174.614, 184.997, 195.998, 207.652, 220, 233.082, 246.942, 
+  261.626, 277.183, 293.665, 311.127, 329.628, 349.228, 369.994, 391.995, 415.305, 440, 466.164, 493.883, 
+  523.251, 554.365, 587.33, 622.254, 659.255, 698.456, 739.989, 783.991, 830.609, 880, 932.328, 987.767, 
+  1046.5, 1108.73, 1174.66, 1244.51, 1318.51, 1396.91, 1479.98, 1567.98, 1661.22, 1760, 1864.66, 1975.53, 
+  2093
+};
+
+// ----------------------------- 14 bit note frequency voltages C1-C7
+const unsigned int noteVolt[EQUAL_NOTES] PROGMEM = {
+  0, 15, 32, 49, 68, 87, 108, 130, 153, 177, 203, 231, 
+  260, 291, 324, 358, 395, 434, 476, 519, 566, 615, 667, 722, 
+  780, 842, 908, 977, 1051, 1129, 1211, 1299, 1391, 1489, 1593, 1704, 
+  1820, 1944, 2075, 2214, 2361, 2517, 2682, 2857, 3043, 3239, 3447, 3667, 
+  3901, 4148, 4411, 4688, 4982, 5294, 5625, 5974, 6345, 6738, 7154, 7595, 
+  8062, 8557, 9081, 9637, 10225, 10849, 11509, 12209, 12950, 13736, 14568, 15450, 
+  16383
+  };
+
+TuningTable tuningTables[2];
+const TuningTable* activeTuning = &tuningTables[0];
+const TuningTable* pendingTuning = 0;
+
+FLASHMEM uint16_t tuningVolts(double frequency) {
+  double volts = (frequency - TUNING_BASE_FREQUENCY) * 16383.0 / (TUNING_TOP_FREQUENCY - TUNING_BASE_FREQUENCY) + 0.5;
+  if (volts < 0) {
+    return 0;
+  }
+  if (volts > 16383) {
+    return 16383;
+  }
+  return (uint16_t)volts;
+}
+
+// 12-TET: the hand-tuned tables above, extended in equal steps past C7
+FLASHMEM void tuningEqual(TuningTable& table) {
+  for (int n = 0; n < TUNING_NOTES; n++) {
+    if (n < EQUAL_NOTES) {
+      table.noteFrequency[n] = noteFrequency[n];
+      table.noteVolt[n] = noteVolt[n];
+    } else {
+      table.noteFrequency[n] = (float)(TUNING_BASE_FREQUENCY * pow(2.0, n / 12.0));
+      table.noteVolt[n] = tuningVolts(table.noteFrequency[n]);
+    }
+  }
+}
+
+// ------------------------ Scala text parsing
+static FLASHMEM const char* skipSpace(const char* p) {
+  while (*p == ' ' || *p == '\t') {
+    p++;
+  }
+  return p;
+}
+
+// Walks a text buffer line by line, skipping '!' comments
+struct LineReader {
+  const char* p;
+
+  // Start of the next line (leading blanks skipped), 0 at the end of the text
+  const char* next(bool allowBlank) {
+    while (*p) {
+      const char* line = p;
+      while (*p && *p != '\n') {
+        p++;
+      }
+      if (*p) {
+        p++;
+      }
+      const char* start = skipSpace(line);
+      bool blank = *start == '\r' || *start == '\n' || *start == 0;
+      if (*line != '!' && (allowBlank || !blank)) {
+        return start;
+      }
+    }
+    return 0;
+  }
+};
+
+static FLASHMEM bool parsePitch(const char* p, float& cents) {
+  p = skipSpace(p);
+  const char* token = p;
+  while (*p && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') {
+    if (*p == '.') {
+      cents = (float)strtod(token, 0);
+      return true;
+    }
+    p++;
+  }
+  char* end;
+  long numerator = strtol(token, &end, 10);
+  long denominator = 1;
+  if (end == token) {
+    return false;
+  }
+  if (*end == '/') {
+    denominator = strtol(end + 1, 0, 10);
+  }
+  if (numerator <= 0 || denominator <= 0) {
+    return false;
+  }
+  cents = (float)(1200.0 * log2((double)numerator / (double)denominator));
+  return true;
+}
+
+FLASHMEM bool scalaParseScale(const char* text, ScalaScale& scale) {
+  LineReader reader = { text };
+  if (reader.next(true) == 0) {   // description, may be empty
+    return false;
+  }
+  const char* line = reader.next(false);
+  if (line == 0) {
+    return false;
+  }
+  long count = strtol(line, 0, 10);
+  if (count < 1 || count > TUNING_MAX_DEGREES) {
+    return false;
+  }
+  scale.count = (uint8_t)count;
+  for (int degree = 0; degree < count; degree++) {
+    line = reader.next(false);
+    if (line == 0 || !parsePitch(line, scale.cents[degree])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+FLASHMEM bool scalaParseKeyboard(const char* text, ScalaKeyboard& keyboard) {
+  LineReader reader = { text };
+  double header[7];
+  for (int i = 0; i < 7; i++) {
+    const char* line = reader.next(false);
+    if (line == 0) {
+      return false;
+    }
+    char* parsed;
+    header[i] = strtod(line, &parsed);
+    if (parsed == line) {
+      return false;
+    }
+  }
+  if (header[0] < 0 || header[0] > TUNING_MAX_DEGREES || header[5] <= 0 || header[6] < 0 || header[6] > 255) {
+    return false;
+  }
+  for (int i = 1; i <= 4; i++) {
+    if (header[i] < 0 || header[i] > 127) {
+      return false;
+    }
+  }
+  keyboard.mapSize = (uint8_t)header[0];
+  keyboard.firstKey = (uint8_t)header[1];
+  keyboard.lastKey = (uint8_t)header[2];
+  keyboard.middleKey = (uint8_t)header[3];
+  keyboard.referenceKey = (uint8_t)header[4];
+  keyboard.referenceFrequency = (float)header[5];
+  keyboard.octaveDegree = (uint8_t)header[6];
+  for (int i = 0; i < keyboard.mapSize; i++) {
+    const char* line = reader.next(false);
+    if (line == 0) {
+      return false;
+    }
+    keyboard.map[i] = (*line == 'x' || *line == 'X') ? -1 : (int16_t)strtol(line, 0, 10);
+  }
+  return true;
+}
+
+FLASHMEM void scalaDefaultKeyboard(ScalaKeyboard& keyboard) {
+  keyboard.mapSize = 0;
+  keyboard.firstKey = 0;
+  keyboard.lastKey = 127;
+  keyboard.middleKey = 60;
+  keyboard.referenceKey = 69;
+  keyboard.referenceFrequency = 440.0f;
+  keyboard.octaveDegree = 0;
+}
+
+// ------------------------ Table build
+static FLASHMEM int floorDiv(int a, int b) {
+  return (a >= 0) ? a / b : -((-a + b - 1) / b);
+}
+
+// Cents of any scale degree >= 0, repeating the scale every period
+static FLASHMEM double degreeCents(const ScalaScale& scale, int degree) {
+  int periods = floorDiv(degree, scale.count);
+  int index = degree - periods * scale.count;
+  return periods * (double)scale.cents[scale.count - 1] + (index > 0 ? scale.cents[index - 1] : 0.0);
+}
+
+static FLASHMEM bool keyCents(const ScalaScale& scale, const ScalaKeyboard& keyboard, int key, double& cents) {
+  int offset = key - keyboard.middleKey;
+  if (keyboard.mapSize == 0) {
+    cents = degreeCents(scale, offset);
+    return true;
+  }
+  int repeats = floorDiv(offset, keyboard.mapSize);
+  int degree = keyboard.map[offset - repeats * keyboard.mapSize];
+  if (degree < 0) {
+    return false;
+  }
+  int octaveDegree = keyboard.octaveDegree > 0 ? keyboard.octaveDegree : scale.count;
+  cents = repeats * degreeCents(scale, octaveDegree) + degreeCents(scale, degree);
+  return true;
+}
+
+FLASHMEM void tuningBuild(const ScalaScale& scale, const ScalaKeyboard& keyboard, TuningTable& table) {
+  tuningEqual(table);
+  double referenceCents;
+  if (!keyCents(scale, keyboard, keyboard.referenceKey, referenceCents)) {
+    return;
+  }
+  for (int n = 0; n < TUNING_NOTES; n++) {
+    int key = n + TUNING_KEY_OFFSET;
+    double cents;
+    if (key > 127 || key < keyboard.firstKey || key > keyboard.lastKey || !keyCents(scale, keyboard, key, cents)) {
+      continue;
+    }
+    double frequency = keyboard.referenceFrequency * pow(2.0, (cents - referenceCents) / 1200.0);
+    table.noteFrequency[n] = (float)frequency;
+    table.noteVolt[n] = tuningVolts(frequency);
+  }
+}
+
+// ------------------------ Table swap
+TuningTable& tuningBackBuffer() {
+  return activeTuning == &tuningTables[0] ? tuningTables[1] : tuningTables[0];
+}
+
+void tuningSchedule(const TuningTable& table) {
+  pendingTuning = &table;
+}
+
+FASTRUN void tuningSwap() {
+  if (pendingTuning != 0) {
+    activeTuning = pendingTuning;
+    pendingTuning = 0;
+  }
+}
@@ -0,0 +1,494 @@
+#include <math.h>
+#include "VoiceEngine.h"
+#include "Placement.h"
+
+template <uint8_t VOICES>
+void VoiceEngineT<VOICES>::begin(const Patch* patch, const CalibrationT<VOICES>* calibration, const TuningTable* tuning) {
+  this->patch = patch;
+  this->calibration = calibration;
+  this->tuning = tuning;
+  susOn = false;
+  pitchBendFreq = 0;
+  pitchBendVolts = 8192;
+  aftertouch = 0;
+  modulationWheel = 0;
+  sustainPedal = 0;
+  knobNumber = 0;
+  knobValue = 0;
+  lfoSemitones = 0;
+  cvSemitones = 0;
+  keys.clear();
+  monoVoice = NO_VOICE;
+  glideSemitones = 0;
+  glideStep = 0;
+  glideTicks = 0;
+  initializeVoices();
+}
+
+template <uint8_t VOICES>
+void VoiceEngineT<VOICES>::initializeVoices() {
+  for (int i = 0; i < VOICES; i++) {
+    voices[i].noteAge = 0;
+    voices[i].midiNote = 0;
+    voices[i].noteOn = false;
+    voices[i].sustained = false;
+    voices[i].keyDown = false;
+    voices[i].velocity = 0;
+    voices[i].prevNote = 0;
+    voices[i].bentNoteVolts = 0;
+    voices[i].bentNoteFreq = 0;
+    voices[i].bentFrequency = 0;
+    voices[i].pressureTarget = 0;
+    voices[i].pressure = 0;
+    voices[i].noteCount = 0;
+  }
+  gates = 0;
+  voiceMask = all();
+  for (int i = 0; i < VOICES; i++) {
+    older[i] = i - 1;                 // wraps at the ends, never followed there
+    newer[i] = i + 1;
+  }
+  oldest = 0;
+  newest = VOICES - 1;
+  for (int note = 0; note < 128; note++) {
+    noteVoice[note] = NO_VOICE;
+  }
+}
+
+// ------------------------ Voice buffer subroutines
+template <uint8_t VOICES>
+int VoiceEngineT<VOICES>::findOldestVoice() const {
+  int oldestVoice = 0;
+  unsigned long oldestAge = 0xFFFFFFFF;
+  for (int i = 0; i < VOICES; i++) {
+    if (!voices[i].noteOn && voices[i].noteAge < oldestAge) {
+      oldestVoice = i;
+      oldestAge = voices[i].noteAge;
+    }
+  }
+  return oldestVoice;
+}
+
+template <uint8_t VOICES>
+FASTRUN int VoiceEngineT<VOICES>::findVoice(uint8_t midiNote) const {
+  return noteVoice[midiNote];
+}
+
+template <uint8_t VOICES>
+FASTRUN void VoiceEngineT<VOICES>::noteOn(uint8_t midiNote, uint8_t velocity, unsigned long now) {
+  if (patch->keyMode != KEY_MODE_POLY) {
+    monoNoteOn(midiNote, velocity, now);
+    return;
+  }
+  int voice = findVoice(midiNote);
+  if (voice == NO_VOICE) {
+    if (voiceMask == 0) {
+      return;                                            // no output ready yet
+    }
+    Mask freeVoices = voiceMask & ~gates;
+    if (freeVoices == 0) {
+      // Oldest note on among the voices that may take one, normally the head
+      voice = oldest;
+      while (!(voiceMask & bit(voice))) {
+        voice = newer[voice];
+      }
+      noteVoice[voices[voice].midiNote] = NO_VOICE;      // stolen
+    } else {
+      voice = Bits::lowest(freeVoices);
+    }
+    voices[voice].prevNote = voices[voice].midiNote;
+    voices[voice].pressureTarget = 0;
+    voices[voice].pressure = 0;
+    noteVoice[midiNote] = voice;
+  }
+  voices[voice].noteAge = now;
+  voices[voice].midiNote = midiNote;
+  voices[voice].noteOn = true;
+  voices[voice].keyDown = true;
+  voices[voice].velocity = velocity;
+  voices[voice].noteCount++;
+  gates |= bit(voice);
+  touch(voice);
+}
+
+template <uint8_t VOICES>
+FASTRUN void VoiceEngineT<VOICES>::touch(uint8_t voice) {
+  if (voice == newest) {
+    return;
+  }
+  if (voice == oldest) {
+    oldest = newer[voice];
+  } else {
+    newer[older[voice]] = newer[voice];
+  }
+  older[newer[voice]] = older[voice];
+  older[voice] = newest;
+  newer[newest] = voice;
+  newest = voice;
+}
+
+template <uint8_t VOICES>
+FASTRUN void VoiceEngineT<VOICES>::noteOff(uint8_t midiNote) {
+  keys.remove(midiNote);
+  int voice = findVoice(midiNote);
+  if (voice != NO_VOICE) {
+    // Mono: the sounding key let go while others are held plays the next
+    if (voice == monoVoice && patch->keyMode != KEY_MODE_POLY && voices[voice].keyDown && keys.count != 0) {
+      uint8_t key = keys.top(patch->keyPriority);
+      monoPlay(key, keys.velocityOf(key), voices[voice].noteAge);
+      return;
+    }
+    voices[voice].keyDown = false;
+    voices[voice].pressureTarget = 0;
+    if (susOn == false) {
+      noteVoice[voices[voice].midiNote] = NO_VOICE;
+      gates &= ~bit(voice);
+      voices[voice].noteOn = false;
+      voices[voice].velocity = 0;
+      voices[voice].midiNote = 0;
+      voices[voice].noteAge = 0;
+    }
+  }
+}
+
+// ------------------------ Mono and legato
+void KeyStack::clear() {
+  for (int key = 0; key < 128; key++) {
+    slot[key] = NO_KEY;
+  }
+  for (int i = 0; i < KEY_STACK_SIZE; i++) {
+    freeSlots[i] = i;
+  }
+  for (int i = 0; i < 4; i++) {
+    held[i] = 0;
+  }
+  oldest = NO_KEY;
+  newest = NO_KEY;
+  count = 0;
+}
+
+FASTRUN void KeyStack::push(uint8_t key, uint8_t keyVelocity) {
+  if (slot[key] != NO_KEY) {
+    remove(key);
+  } else if (count == KEY_STACK_SIZE) {
+    remove(note[oldest]);
+  }
+  uint8_t s = freeSlots[KEY_STACK_SIZE - 1 - count];
+  count++;
+  slot[key] = s;
+  note[s] = key;
+  velocity[s] = keyVelocity;
+  older[s] = newest;
+  newer[s] = NO_KEY;
+  if (newest == NO_KEY) {
+    oldest = s;
+  } else {
+    newer[newest] = s;
+  }
+  newest = s;
+  held[key >> 5] |= 1u << (key & 31);
+}
+
+FASTRUN void KeyStack::remove(uint8_t key) {
+  uint8_t s = slot[key];
+  if (s == NO_KEY) {
+    return;
+  }
+  if (older[s] == NO_KEY) {
+    oldest = newer[s];
+  } else {
+    newer[older[s]] = newer[s];
+  }
+  if (newer[s] == NO_KEY) {
+    newest = older[s];
+  } else {
+    older[newer[s]] = older[s];
+  }
+  slot[key] = NO_KEY;
+  count--;
+  freeSlots[KEY_STACK_SIZE - 1 - count] = s;
+  held[key >> 5] &= ~(1u << (key & 31));
+}
+
+FASTRUN uint8_t KeyStack::top(uint8_t priority) const {
+  if (count == 0) {
+    return NO_KEY;
+  }
+  if (priority == KEY_PRIORITY_LOW) {
+    for (int i = 0; i < 4; i++) {
+      if (held[i]) {
+        return i * 32 + __builtin_ctz(held[i]);
+      }
+    }
+  } else if (priority == KEY_PRIORITY_HIGH) {
+    for (int i = 3; i >= 0; i--) {
+      if (held[i]) {
+        return i * 32 + 31 - __builtin_clz(held[i]);
+      }
+    }
+  }
+  return note[newest];
+}
+
+template <uint8_t VOICES>
+FASTRUN void VoiceEngineT<VOICES>::monoNoteOn(uint8_t midiNote, uint8_t velocity, unsigned long now) {
+  keys.push(midiNote, velocity);
+  if (voiceMask == 0) {
+    return;                                              // no output ready yet
+  }
+  // With low or high priority a key past the sounding one changes nothing
+  if (keys.top(patch->keyPriority) == midiNote) {
+    monoPlay(midiNote, velocity, now);
+  }
+}
+
+template <uint8_t VOICES>
+FASTRUN void VoiceEngineT<VOICES>::monoPlay(uint8_t midiNote, uint8_t velocity, unsigned long now) {
+  // voiceMask only grows, the first voice taken stays usable
+  if (monoVoice == NO_VOICE) {
+    monoVoice = Bits::lowest(voiceMask);
+  }
+  Voice& voice = voices[monoVoice];
+  bool sounding = (gates & bit(monoVoice)) != 0;
+  bool legato = patch->keyMode == KEY_MODE_LEGATO && sounding && voice.keyDown;
+  if (sounding) {
+    noteVoice[voice.midiNote] = NO_VOICE;
+  }
+  if (legato && patch->glideTime != 0 && midiNote != voice.midiNote) {
+    // From the pitch sounding now, so a glide cut short turns smoothly
+    glideSemitones += 12.0 * log2(tuning->noteFrequency[voice.midiNote] / tuning->noteFrequency[midiNote]);
+    glideTicks = patch->glideTime;
+    glideStep = glideSemitones / glideTicks;
+  } else if (!legato) {
+    glideSemitones = 0;
+    glideTicks = 0;
+    voice.pressureTarget = 0;
+    voice.pressure = 0;
+    voice.noteCount++;                                   // gate retrigger
+  }
+  voice.prevNote = voice.midiNote;
+  voice.noteAge = now;
+  voice.midiNote = midiNote;
+  voice.noteOn = true;
+  voice.keyDown = true;
+  voice.velocity = velocity;
+  noteVoice[midiNote] = monoVoice;
+  gates |= bit(monoVoice);
+  touch(monoVoice);
+}
+
+// Sustain management. Voices outside gates are free, with sustained and
+// keyDown already clear, so only the sounding ones are visited.
+template <uint8_t VOICES>
+FASTRUN void VoiceEngineT<VOICES>::unsustainNotes() {
+  Mask sounding = gates;
+  while (sounding) {
+    int i = Bits::lowest(sounding);
+    sounding &= sounding - 1;
+    voices[i].sustained = false;
+    if (voices[i].keyDown == false) {
+      if (noteVoice[voices[i].midiNote] == i) {
+        noteVoice[voices[i].midiNote] = NO_VOICE;
+      }
+      gates &= ~bit(i);
+      voices[i].noteOn = false;
+      voices[i].velocity = 0;
+      voices[i].midiNote = 0;
+      voices[i].noteAge = 0;
+    }
+  }
+}
+
+// Mono fallback needs held keys, so the stack goes first
+template <uint8_t VOICES>
+void VoiceEngineT<VOICES>::releaseKeys() {
+  keys.clear();
+  Mask sounding = gates;
+  while (sounding) {
+    int i = Bits::lowest(sounding);
+    sounding &= sounding - 1;
+    if (voices[i].keyDown) {
+      noteOff(voices[i].midiNote);
+    }
+  }
+}
+
+template <uint8_t VOICES>
+FASTRUN void VoiceEngineT<VOICES>::sustainNotes() {
+  Mask sounding = gates;
+  while (sounding) {
+    int i = Bits::lowest(sounding);
+    sounding &= sounding - 1;
+    voices[i].sustained = true;
+  }
+}
+
+// ------------------------ Event handler
+template <uint8_t VOICES>
+FASTRUN void VoiceEngineT<VOICES>::handleEvent(const MidiEvent& event, unsigned long now) {
+
+  // -------------------- Note On
+  if (event.type == EVENT_TYPE_NOTE_ON) {
+    noteOn(event.data1, event.data2, now);
+  }
+
+  // -------------------- Note Off
+  if (event.type == EVENT_TYPE_NOTE_OFF) {
+    noteOff(event.data1);
+  }
+
+  // ------------------ Pitchbend
+  if (event.type == EVENT_TYPE_PITCH_BEND) {
+    pitchBendVolts = event.data2 << 7 | event.data1; // already 14 bits = Volts out
+    // 0..16383 onto +range..-range, same integer rounding as Teensy's map()
+    long range = patch->pitchBendRange;
+    pitchBendFreq = (long)pitchBendVolts * (-2 * range + 1) / 16384 + range;
+  }
+
+  // ------------------ Aftertouch
+  if (event.type == EVENT_TYPE_CHANNEL_PRESSURE) {
+    aftertouch = event.data1;
+  }
+
+  // ------------------ Poly pressure, to the voice playing that key
+  if (event.type == EVENT_TYPE_POLY_PRESSURE) {
+    int voice = findVoice(event.data1);
+    if (voice != NO_VOICE) {
+      voices[voice].pressureTarget = event.data2;
+    }
+  }
+
+  // ------------------ Modwheel
+  if (event.type == EVENT_TYPE_CONTROL_CHANGE && event.data1 == 1) {
+    modulationWheel = event.data2;
+  }
+
+  // ------------------ Sustain
+  if (event.type == EVENT_TYPE_CONTROL_CHANGE && event.data1 == 64) {
+    sustainPedal = event.data2;
+    if (sustainPedal > 63) {
+      susOn = true;
+      sustainNotes();
+    }
+    if (sustainPedal <= 63) {
+      susOn = false;
+      unsustainNotes();
+    }
+  }
+
+  // ------------------ MIDI CC
+  if (event.type == EVENT_TYPE_CONTROL_CHANGE) {
+    knobNumber = event.data1;
+    knobValue = event.data2;
+    if (knobNumber > 69 && knobNumber < 88) {
+      // ...
+    }
+  }
+}
+
+// ------------------------ Per-tick CV math
+template <uint8_t VOICES>
+FASTRUN void VoiceEngineT<VOICES>::smoothPressure() {
+  for (int i = 0; i < VOICES; i++) {
+    int32_t target = (int32_t)voices[i].pressureTarget << 8;
+    int32_t pressure = voices[i].pressure;
+    int32_t step = (target - pressure) >> PRESSURE_SMOOTH_SHIFT;
+    // The last few LSBs would never be closed from below, snap to the target
+    voices[i].pressure = step == 0 ? target : pressure + step;
+  }
+}
+
+template <uint8_t VOICES>
+FASTRUN void VoiceEngineT<VOICES>::glide() {
+  if (glideTicks == 0) {
+    return;
+  }
+  glideTicks--;
+  glideSemitones = glideTicks == 0 ? 0 : glideSemitones - glideStep;
+}
+
+template <uint8_t VOICES>
+FASTRUN void VoiceEngineT<VOICES>::updateLfo(uint32_t phase) {
+  int32_t lfoTriangle = (int32_t)((phase < 0x80000000u ? phase : ~phase) - 0x40000000u);
+  lfoSemitones = (double)lfoTriangle / (double)0x40000000 * patch->lfoDepthCents / 100.0 * modulationWheel / 127.0;
+}
+
+template <uint8_t VOICES>
+FASTRUN void VoiceEngineT<VOICES>::updateCvLfo(uint16_t level) {
+  cvSemitones = (double)((int32_t)level - 32768) / 32768.0 * patch->cvLfoDepth;
+}
+
+template <uint8_t VOICES>
+FASTRUN double VoiceEngineT<VOICES>::pitchFactor() const {
+  double pitchBendPosition = (double)pitchBendFreq / (double)16383 * 2.0;
+  return pow(2.0, (pitchBendPosition + lfoSemitones + cvSemitones) / 12.0);
+}
+
+template <uint8_t VOICES>
+FASTRUN double VoiceEngineT<VOICES>::glideFactor() const {
+  return glideTicks == 0 ? 1.0 : pow(2.0, glideSemitones / 12.0);
+}
+
+template <uint8_t VOICES>
+FASTRUN void VoiceEngineT<VOICES>::render() {
+  double factor = pitchFactor();
+  for (int i = 0; i < VOICES; i++) {
+    renderVoice(i, factor);
+  }
+  // A glide bends the mono voice on its own
+  if (glideTicks != 0) {
+    renderVoice(monoVoice, factor * glideFactor());
+  }
+}
+
+template <uint8_t VOICES>
+FASTRUN void VoiceEngineT<VOICES>::renderVoice(int voice, double factor) {
+  int midiNoteVoltage = tuning->noteVolt[voices[voice].midiNote];
+  int32_t calibratedVolts = ((int32_t)(midiNoteVoltage * factor) * calibration->voltGain[voice] >> 14) + calibration->voltOffset[voice];
+  voices[voice].bentFrequency = tuning->noteFrequency[voices[voice].midiNote] * factor;
+  voices[voice].bentNoteFreq = voices[voice].bentFrequency;
+  if (calibratedVolts < 0) {
+    calibratedVolts = 0;
+  }
+  if (calibratedVolts > 16383) {
+    calibratedVolts = 16383;
+  }
+  voices[voice].bentNoteVolts = calibratedVolts;
+}
+
+template <uint8_t VOICES>
+FASTRUN bool VoiceEngineT<VOICES>::idle() const {
+  if (gates != 0) {
+    return false;
+  }
+  if (modulationWheel != 0 && patch->lfoDepthCents != 0) {
+    return false;
+  }
+  if (patch->cvLfoDepth != 0 || glideTicks != 0) {
+    return false;
+  }
+  for (int i = 0; i < VOICES; i++) {
+    if (voices[i].noteOn || voices[i].pressure != (uint16_t)(voices[i].pressureTarget << 8)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The firmware's voice count, and on the host the counts tools/voice_bench.cpp
+// compares; a copy per count in ITCM would not fit the device
+template struct VoiceEngineT<NUM_VOICES>;
+#if !defined(__IMXRT1062__)
+#if NUM_VOICES != 8
+template struct VoiceEngineT<8>;
+#endif
+#if NUM_VOICES != 16
+template struct VoiceEngineT<16>;
+#endif
+#if NUM_VOICES != 32
+template struct VoiceEngineT<32>;
+#endif
+#if NUM_VOICES != 64
+template struct VoiceEngineT<64>;
+#endif
+#endif
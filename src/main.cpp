@@ -4,299 +4,879 @@
 #include <Adafruit_MCP4728.h>
 #include <SoftwareSerial.h>
 #include <Wire.h>
-#include <Adafruit_MCP23X17.h>
 #include "TCA9548.h"
 #include <EEPROM.h>
 #include "Bounce2.h"
 #include <SPI.h>
+#include "MidiClock.h"
+#include "Settings.h"
+#include "SysEx.h"
+#include "EventQueue.h"
+#include "Panel.h"
+#include "I2cBus.h"
+#include "Tuning.h"
+#include "Budget.h"
+#include "Trace.h"
+#include "VoiceEngine.h"
+#include "CvOutput.h"
+#include "SpiOutput.h"
+#include "Schedule.h"
+#include "Gate.h"
+#include "Telemetry.h"
+#include "Player.h"
+#include "Tasks.h"
+#include "Startup.h"
+#include "AnalogInput.h"
+#include <ADC.h>
+#include <AnalogBufferDMA.h>
 
 #define MCP1_CS 10
-#define MCP2_CS 11
-#define NUM_VOICES 8
+#define MCP2_CS 36    // 11 is MOSI on the Teensy 4.1
+#define DDS_FSYNC_FIRST 28   // AD9833 FSYNC, one pin per voice from here
 #define MIDI_CHANNEL 1
+#define INGEST_BURST 16
+#define PANEL_MCP_ADDRESS 0x20
+#define PANEL_INTA_PIN 2
+#define PANEL_INTB_PIN 3
+#define MCP23017_GPINTENA 0x04
+#define MCP23017_IOCON 0x0A
+#define MCP23017_IOCON_MIRROR 0x40
+#define MCP23017_GPPUA 0x0C
+#define MCP23017_GPIOA 0x12
+#define LFO_CV_PIN A0       // 0-3.3 V external LFO
+#define NUM_DACS 2
+#define NUM_SPI_DACS 1
+#define CONTROL_RATE_HZ 1000
+#define LOOP_BUDGET_US 250
+#define TICK_BUDGET_US 200
+#define BUDGET_BUCKET_SHIFT 12    // 4096 cycles, about 7 us at 600 MHz
+#define IDLE_HOLDOFF_US 2000000   // VCA releases still get live CV
+#define WAKE_BUDGET_US 250        // wake to first output frame
+#define WAKE_BUCKET_SHIFT 3       // 8 us buckets
+#define TELEMETRY_CPU_PERMILLE 20 // 2 % of the CPU at most
+#define TELEMETRY_VOICE_US 20000
+#define TELEMETRY_COUNTER_US 100000
+#define TELEMETRY_HISTOGRAM_US 250000   // one histogram each, in turn
+#define TELEMETRY_TASK_US 500000
+#define TELEMETRY_TRACE_US 100000     // only when something was logged
+#define BUS_STATS_US 100000
+#define STARTUP_STEP_US 500      // one output setup step at most this often
+
+// Output backend, pick one with -D CV_OUTPUT=...
+#define CV_OUTPUT_MCP4728 0
+#define CV_OUTPUT_SPI_DAC 1
+#define CV_OUTPUT_AD9833 2
+#define CV_OUTPUT_SPI_DMA 3
+#define CV_OUTPUT_ROUTED 4       // MCP4728 banks and SPI DACs through voiceRoute[]
+#ifndef CV_OUTPUT
+#define CV_OUTPUT CV_OUTPUT_MCP4728
+#endif
+
 const int DETUNE = 0;
-const int PITCH_BEND_RANGE = 2;
 uint16_t benderValue = 0;
 uint8_t midiTempo;
 uint8_t midiController[10];
-bool susOn = false;
-uint8_t midiNote = 0;
-uint8_t velocity = 0;
-double pitchBendFreq = 0;
-int pitchBendVolts = 8192;
-uint8_t aftertouch = 0;
-uint8_t modulationWheel = 0;
 uint8_t ccNumber = 0;
 uint8_t ccValue = 0;
-uint8_t sustainPedal = 0;
-uint8_t knobNumber = 0;
-uint8_t knobValue = 0;
-int midiNoteVoltage = 0;
-
-// ----------------------------- MIDI note frequencies C1-C7
-float noteFrequency [73] = {
-  32.7032, 34.6478, 36.7081, 38.8909, 41.2034, 43.6535, 46.2493, 48.9994, 51.9131, 55, 58.2705, 61.7354, 
-  65.4064, 69.2957, 73.4162, 77.7817, 82.4069, 87.3071, 92.4986, 97.9989, 103.826, 110, 116.541, 123.471, 
-  130.813, 138.591, 146.832, 155.563, 164.814, 174.614, 184.997, 195.998, 207.652, 220, 233.082, 246.942, 
-  261.626, 277.183, 293.665, 311.127, 329.628, 349.228, 369.994, 391.995, 415.305, 440, 466.164, 493.883, 
-  523.251, 554.365, 587.33, 622.254, 659.255, 698.456, 739.989, 783.991, 830.609, 880, 932.328, 987.767, 
-  1046.5, 1108.73, 1174.66, 1244.51, 1318.51, 1396.91, 1479.98, 1567.98, 1661.22, 1760, 1864.66, 1975.53, 
-  2093
+VoiceEngine engine;
+VoiceEngine stagedEngine;   // engine with the next scheduled batch applied
+MidiClock midiClock;
+SysExStream sysex;
+EventQueue inputQueue;
+Panel panel;
+bool panelReady = false;
+volatile bool panelChanged = false;
+bool panelReadPending = false;
+volatile bool panelReadDone = false;
+volatile bool panelReadOk = false;
+uint8_t panelReadBuffer[2];
+
+#if CV_OUTPUT == CV_OUTPUT_MCP4728 || CV_OUTPUT == CV_OUTPUT_ROUTED
+// Both MCP4728s answer on 0x60, each sits behind its own TCA9548 channel
+const Mcp4728Bank dacBanks[NUM_DACS] = { { 0, MCP4728_ADDRESS }, { 1, MCP4728_ADDRESS } };
+static_assert(NUM_DACS * MCP4728_BANK_US <= 1000000 / CONTROL_RATE_HZ * 3 / 4,
+              "every MCP4728 bank must update within a control tick, with room for gates and panel");
+#endif
+
+#if CV_OUTPUT == CV_OUTPUT_SPI_DAC
+const uint8_t dacCsPin[] = { MCP1_CS, MCP2_CS };
+SpiDacOutput<Mcp48cxb8, NUM_SPI_DACS> cvOutput;
+static_assert(NUM_SPI_DACS * Mcp48cxb8::CHANNELS >= NUM_VOICES, "not enough SPI DAC channels");
+#elif CV_OUTPUT == CV_OUTPUT_SPI_DMA
+const uint8_t dacCsPin[] = { MCP1_CS, MCP2_CS };
+DmaSpiDacOutput<Mcp48cxb8, NUM_SPI_DACS> cvOutput;
+static_assert(NUM_SPI_DACS * Mcp48cxb8::CHANNELS >= NUM_VOICES, "not enough SPI DAC channels");
+#elif CV_OUTPUT == CV_OUTPUT_AD9833
+static_assert(NUM_VOICES <= 8, "one FSYNC pin per voice is listed");
+const uint8_t ddsFsyncPin[NUM_VOICES] = { DDS_FSYNC_FIRST, DDS_FSYNC_FIRST + 1, DDS_FSYNC_FIRST + 2, DDS_FSYNC_FIRST + 3,
+                                          DDS_FSYNC_FIRST + 4, DDS_FSYNC_FIRST + 5, DDS_FSYNC_FIRST + 6, DDS_FSYNC_FIRST + 7 };
+Ad9833Output<NUM_VOICES> cvOutput;
+#elif CV_OUTPUT == CV_OUTPUT_ROUTED
+// Voices 0-7 on the MCP4728 banks, 8-15 on the SPI DAC; [env:teensy41_routed]
+// in platformio.ini builds it with NUM_VOICES 16
+const uint8_t dacCsPin[] = { MCP1_CS, MCP2_CS };
+const CvRoute voiceRoute[] = {
+  { ROUTE_FIRST, 0 }, { ROUTE_FIRST, 1 }, { ROUTE_FIRST, 2 }, { ROUTE_FIRST, 3 },
+  { ROUTE_FIRST, 4 }, { ROUTE_FIRST, 5 }, { ROUTE_FIRST, 6 }, { ROUTE_FIRST, 7 },
+  { ROUTE_SECOND, 0 }, { ROUTE_SECOND, 1 }, { ROUTE_SECOND, 2 }, { ROUTE_SECOND, 3 },
+  { ROUTE_SECOND, 4 }, { ROUTE_SECOND, 5 }, { ROUTE_SECOND, 6 }, { ROUTE_SECOND, 7 }
 };
+static_assert(sizeof(voiceRoute) / sizeof(voiceRoute[0]) == NUM_VOICES, "a route for every voice, a voice for every route");
+RoutedOutput<Mcp4728Output<NUM_DACS>, SpiDacOutput<Mcp48cxb8, NUM_SPI_DACS>, NUM_VOICES> cvOutput;
+#else
+static_assert(NUM_DACS * MCP4728_CHANNELS >= NUM_VOICES, "not enough MCP4728 channels");
+Mcp4728Output<NUM_DACS> cvOutput;
+#endif
 
-// ----------------------------- 14 bit note frequency voltages C1-C7
-const unsigned int noteVolt[73] = {
-  0, 15, 32, 49, 68, 87, 108, 130, 153, 177, 203, 231, 
-  260, 291, 324, 358, 395, 434, 476, 519, 566, 615, 667, 722, 
-  780, 842, 908, 977, 1051, 1129, 1211, 1299, 1391, 1489, 1593, 1704, 
-  1820, 1944, 2075, 2214, 2361, 2517, 2682, 2857, 3043, 3239, 3447, 3667, 
-  3901, 4148, 4411, 4688, 4982, 5294, 5625, 5974, 6345, 6738, 7154, 7595, 
-  8062, 8557, 9081, 9637, 10225, 10849, 11509, 12209, 12950, 13736, 14568, 15450, 
-  16383
-  };
-
-  struct Voice {
-    unsigned long noteAge;
-    uint8_t midiNote;
-    bool noteOn;
-    bool sustained;
-    bool keyDown;
-    uint8_t velocity;
-    uint8_t prevNote;
-    uint16_t bentNoteVolts;
-    uint16_t bentNoteFreq;
-  };
-
-Voice voices[NUM_VOICES];
-
-void initializeVoices() {
-  for (int i = 0; i < NUM_VOICES; i++) {
-    voices[i].noteAge = 0;
-    voices[i].midiNote = 0;
-    voices[i].noteOn = false;
-    voices[i].sustained = false;
-    voices[i].keyDown = false;
-    voices[i].velocity = 0;
-    voices[i].prevNote = 0;
-    voices[i].bentNoteVolts = 0;
-    voices[i].bentNoteFreq = 0;
-    }
+IntervalTimer controlTimer;
+volatile bool controlTickDue = false;
+uint32_t controlTicks = 0;
+
+static_assert(NUM_VOICES <= 16, "gates use the two ports of one MCP23017");
+GateOutput gateOutput;
+Player player;
+
+IntervalTimer commitTimer;
+OutputSchedule schedule;
+bool onsetPending = false;
+uint32_t onsetTime = 0;
+
+BudgetMonitor loopBudget;
+BudgetMonitor tickBudget;
+Degrader degrader;
+bool loopOverrun = false;
+uint8_t loopWork = 0;
+uint16_t loopEvents = 0;
+TaskScheduler scheduler;
+
+Startup startup;
+bool firstNoteShown = false;        // time to first note went to the console
+
+// LFO CV on the first ADC: its timer starts each conversion, DMA fills one half while
+// the analog task reduces the other. In DTCM, which is not cached, so the
+// CPU sees what DMA wrote without a cache invalidate.
+ADC adc;
+static volatile uint16_t __attribute__((aligned(32))) lfoCvBuffer[2][ANALOG_BLOCK];
+AnalogBufferDMA lfoCvDma(lfoCvBuffer[0], ANALOG_BLOCK, lfoCvBuffer[1], ANALOG_BLOCK);
+AnalogInput analogInput;
+
+bool idle = false;
+uint32_t lastBusy = 0;
+uint32_t wakeTime = 0;
+bool wakePending = false;
+BudgetMonitor wakeLatency;          // µs from WFI return to the first frame
+uint32_t idleEntries = 0;
+uint64_t idleCycles = 0;            // spent in WFI
+DMAMEM uint8_t sysexTxMemory[4 * SYSEX_MAX_MESSAGE];
+
+Telemetry telemetry;
+uint32_t telemetryVoiceAt = 0;
+uint32_t telemetryCounterAt = 0;
+uint32_t telemetryHistogramAt = 0;
+uint8_t telemetryHistogram = 0;
+uint32_t telemetryTaskAt = 0;
+uint32_t telemetryTraceAt = 0;
+uint32_t telemetryTraceSent = 0;    // trace.total at the last TRACE frame
+
+// Only touched when a scale arrives, so out of DTCM
+DMAMEM char scalaText[TUNING_TEXT_SIZE];
+bool scalaTextReady = false;
+DMAMEM ScalaScale scalaScale;
+DMAMEM ScalaKeyboard scalaKeyboard;
+
+FLASHMEM void scalaTextDefaults() {
+  memset(scalaText, 0, sizeof(scalaText));
 }
 
-// ------------------------ Debug Print
-void debugPrint(int voice) {
-  Serial.print("Voice #" + String(voice));
-  Serial.print("  Key: ");
-  Serial.print(voices[voice].midiNote);
-  Serial.print("\tFreq: ");
-  Serial.print(noteFrequency[voices[voice].midiNote]);
-  Serial.print("\tBent: ");
-  Serial.print(voices[voice].bentNoteFreq);
-  Serial.print("\tkeyDown: ");
-  Serial.print(voices[voice].keyDown);
-  Serial.print("\tOn: ");
-  Serial.print(voices[voice].noteOn);
-  Serial.print("\t -> Sustained: ");
-  Serial.println(voices[voice].sustained);
+void scalaTextLoaded() {
+  scalaTextReady = true;
 }
 
-// ------------------------ Voice buffer subroutines 
-int findOldestVoice() {
-  int oldestVoice = 0;
-  unsigned long oldestAge = 0xFFFFFFFF;
-  for (int i = 0; i < NUM_VOICES; i++) {
-    if (!voices[i].noteOn && voices[i].noteAge < oldestAge) {
-      oldestVoice = i;
-      oldestAge = voices[i].noteAge;
-    }
+const SysExBlock sysexBlocks[] = {
+  { SYSEX_BLOCK_PATCH, (uint8_t*)&patch, sizeof(Patch), patchDefaults, patchValidate },
+  { SYSEX_BLOCK_CALIBRATION, (uint8_t*)&calibration, sizeof(Calibration), calibrationDefaults, 0 },
+  { SYSEX_BLOCK_SCALA, (uint8_t*)scalaText, sizeof(scalaText), scalaTextDefaults, scalaTextLoaded },
+  { SYSEX_BLOCK_SEQUENCE, (uint8_t*)&sequence, sizeof(Sequence), sequenceDefaults, 0 },
+};
+
+MIDI_CREATE_INSTANCE(HardwareSerial, Serial1,  MIDI);
+
+// ------------------------ Event handler (merged DIN/USB stream)
+FASTRUN void handleEvent(VoiceEngine& target, const MidiEvent& event) {
+
+  // ------------------ Panel buttons
+  if (event.type == EVENT_TYPE_PANEL) {
+    // ...
+    return;
   }
-  return oldestVoice;
+
+  // ------------------ Keys feed the arpeggiator instead of the voices
+  if (patch.playMode == PLAY_MODE_ARP && (event.type == EVENT_TYPE_NOTE_ON || event.type == EVENT_TYPE_NOTE_OFF)) {
+    player.keyEvent(event);
+    return;
+  }
+
+  // ------------------ Notes, bend, modwheel, sustain, CC
+  if (event.type == EVENT_TYPE_NOTE_ON && target.voiceMask == 0) {
+    startup.notesMasked++;
+  }
+  target.handleEvent(event, millis());
 }
 
-int findVoice(uint8_t midiNote) {
-  int foundVoice = -1;
-  for (int i = 0; i < NUM_VOICES; i++) {
-    if (voices[i].noteOn && voices[i].midiNote == midiNote) {
-      foundVoice = i;
-      break;
-    }
+// Events that only change state read at the next control tick: they need no
+// scheduled frame of their own
+FASTRUN bool tickOnlyEvent(const MidiEvent& event) {
+  if (event.type == EVENT_TYPE_POLY_PRESSURE || event.type == EVENT_TYPE_CHANNEL_PRESSURE) {
+    return true;
   }
-  return foundVoice;
+  return patch.playMode == PLAY_MODE_ARP && (event.type == EVENT_TYPE_NOTE_ON || event.type == EVENT_TYPE_NOTE_OFF);
 }
 
-void noteOn(uint8_t midiNote, uint8_t velocity) {
-  int voice = findVoice(midiNote);
-  if (voice == -1) {
-    int numPlayingVoices = 0;
-    for (int i = 0; i < NUM_VOICES; i++) {
-      if (voices[i].noteOn) {
-        numPlayingVoices++;
-      }
-    }
-    if (numPlayingVoices >= NUM_VOICES) {
-      unsigned long oldestAge = 0xFFFFFFFF;
-      int oldestVoice = -1;
-      for (int i = 0; i < NUM_VOICES; i++) {
-        if (voices[i].noteAge < oldestAge) {
-          oldestAge = voices[i].noteAge;
-          oldestVoice = i;
-        }
-      }
-      voice = oldestVoice;
-    } else {
-      for (int i = 0; i < NUM_VOICES; i++) {
-        if (!voices[i].noteOn) {
-          voice = i;
-          break;
-        }
-      }
-    }
-    voices[voice].prevNote = voices[voice].midiNote;
+// ------------------------ Panel expander interrupt (INTA and INTB)
+FASTRUN void panelInterrupt() {
+  panelChanged = true;
+}
+
+// Runs from the I2C interrupt once the port read has finished
+FASTRUN void panelReadComplete(const I2cTransaction& transaction, bool ok) {
+  (void)transaction;
+  panelReadOk = ok;
+  panelReadDone = true;
+}
+
+// Runs from the I2C interrupt once the gate latches are written
+FASTRUN void gateWriteComplete(const I2cTransaction& transaction, bool ok) {
+  (void)transaction;
+  uint32_t pitchWrittenAt = 0;
+  bool pitchWritten = cvOutput.frameWritten(gateOutput.openingFrame, pitchWrittenAt);
+  gateOutput.complete(ok, micros(), pitchWritten, pitchWrittenAt);
+}
+
+// ------------------------ Control tick timer
+FASTRUN void controlTimerInterrupt() {
+  controlTickDue = true;
+}
+
+// ------------------------ Scheduled output: one-shot, writes the staged frame
+FASTRUN void frameWritten(uint32_t gates) {
+  startup.frameWritten(gates, micros());
+  if (wakePending) {
+    wakePending = false;
+    wakeLatency.record(micros() - wakeTime);
   }
-  voices[voice].noteAge = millis();
-  voices[voice].midiNote = midiNote;
-  voices[voice].noteOn = true;
-  voices[voice].keyDown = true;
-  voices[voice].velocity = velocity;
 }
 
-void noteOff(uint8_t midiNote) {
-  int voice = findVoice(midiNote);
-  if (voice != -1) {
-    voices[voice].keyDown = false;
-    if (susOn == false) {
-      voices[voice].noteOn = false;
-      voices[voice].velocity = 0;
-      voices[voice].midiNote = 0;
-      voices[voice].noteAge = 0;
-    }
+FASTRUN void commitStagedFrame() {
+  cvOutput.frame(stagedEngine.voices, NUM_VOICES, micros());
+  schedule.commit(micros());
+  frameWritten(stagedEngine.gates);
+}
+
+FASTRUN void commitTimerInterrupt() {
+  commitTimer.end();
+  commitStagedFrame();
+}
+
+// Nothing sounding, moving or waiting anywhere: output would not change and
+// no work is pending until an interrupt brings some
+FASTRUN bool systemQuiet() {
+  return engine.idle() && player.idle(patch.playMode) && inputQueue.empty()
+      && !schedule.staged && !panelChanged && !panelReadPending && !panel.settling()
+      && i2cBus.idle() && !gateOutput.busy && gateOutput.port == 0
+      && !sysex.txPending() && !scalaTextReady && pendingTuning == 0
+      && startup.complete();
+}
+
+// WFI with interrupts masked, so one arriving after the checks still ends
+// it at once. Serial1 RX, USB and the panel INT line wake it, SysTick does
+// every millisecond anyway. Messages either port buffered before the mask
+// went up (usbMIDI as well as Serial1) keep it awake, their interrupt has
+// already run. The core only stops its clock: the Teensy core leaves the
+// low power mode at RUN, peripherals and timers keep going.
+FASTRUN void idleSleep() {
+  uint32_t start = ARM_DWT_CYCCNT;
+  __disable_irq();
+  if (!panelChanged && Serial1.available() == 0 && usb_midi_available() == 0) {
+    asm volatile("wfi");
   }
+  __enable_irq();
+  idleCycles += ARM_DWT_CYCCNT - start;
+  wakeTime = micros();
 }
 
-// Sustain management
-void unsustainNotes() {
-  for (int i = 0; i < NUM_VOICES; i++) {
-    //if (voices[i].noteOn == false) {
-      voices[i].sustained = false;
-      if (voices[i].keyDown == false) {
-        voices[i].noteOn = false;
-         voices[i].velocity = 0;
-        voices[i].midiNote = 0;
-        voices[i].noteAge = 0;
-      }
-    //}
-    
-      
-    
+// ------------------------ Telemetry: one frame per loop pass at most
+// Voice snapshots, counters, trace entries, histograms and task costs each on
+// their own period, within the CPU share the writer allows and only if USB
+// has room for the frame.
+static_assert(TELEMETRY_COUNTER_I2C_WAIT_MAX - TELEMETRY_COUNTER_I2C_WAIT == I2C_PRIORITIES, "one wait counter per I2C priority");
+static_assert(TELEMETRY_COUNTER_INPUT_LATENCY - TELEMETRY_COUNTER_INPUT_FILTERED == NUM_EVENT_SOURCES, "one input counter per event source");
+static_assert(TELEMETRY_COUNTER_INPUT_LATENCY_MAX - TELEMETRY_COUNTER_INPUT_LATENCY == NUM_EVENT_SOURCES, "one input counter per event source");
+
+bool sendTelemetry() {
+  uint32_t start = ARM_DWT_CYCCNT;
+  if (!telemetry.allowed(start)) {
+    return false;
   }
+  uint32_t now = micros();
+  uint16_t length;
+  if (now - telemetryVoiceAt >= TELEMETRY_VOICE_US) {
+    telemetryVoiceAt = now;
+    length = telemetry.voices(engine, now);
+  } else if (now - telemetryCounterAt >= TELEMETRY_COUNTER_US) {
+    telemetryCounterAt = now;
+    uint32_t values[TELEMETRY_COUNTERS_COUNT];
+    values[TELEMETRY_COUNTER_DIN_RECEIVED] = inputQueue.sources[EVENT_SOURCE_DIN].received;
+    values[TELEMETRY_COUNTER_USB_RECEIVED] = inputQueue.sources[EVENT_SOURCE_USB].received;
+    values[TELEMETRY_COUNTER_QUEUE_OVERFLOWS] = inputQueue.sources[EVENT_SOURCE_DIN].overflows + inputQueue.sources[EVENT_SOURCE_USB].overflows;
+    values[TELEMETRY_COUNTER_I2C_COMPLETED] = i2cBus.stats.completed;
+    values[TELEMETRY_COUNTER_I2C_FAILED] = i2cBus.stats.failed;
+    values[TELEMETRY_COUNTER_I2C_DROPPED] = i2cBus.stats.dropped;
+    values[TELEMETRY_COUNTER_I2C_UTILIZATION] = i2cBus.stats.utilization;
+    values[TELEMETRY_COUNTER_GATE_WRITES] = gateOutput.writes;
+    values[TELEMETRY_COUNTER_GATE_EARLY] = gateOutput.early;
+    values[TELEMETRY_COUNTER_SCHEDULE_LATE] = schedule.late;
+    values[TELEMETRY_COUNTER_DEGRADE_LEVEL] = degrader.level;
+    values[TELEMETRY_COUNTER_TELEMETRY_DROPPED] = telemetry.dropped;
+    values[TELEMETRY_COUNTER_IDLE_ENTRIES] = idleEntries;
+    values[TELEMETRY_COUNTER_VOICES_READY] = startup.voiceMask;
+    values[TELEMETRY_COUNTER_VOICES_ABSENT] = startup.absentMask;
+    values[TELEMETRY_COUNTER_FIRST_NOTE_US] = startup.firstNote;
+    values[TELEMETRY_COUNTER_CV_RATE] = analogInput.rate(ANALOG_LFO_CV);
+    values[TELEMETRY_COUNTER_CV_NOISE] = analogInput.noiseCentiLsb(ANALOG_LFO_CV);
+    values[TELEMETRY_COUNTER_PANEL_READS] = panel.readsPerSecond;
+    values[TELEMETRY_COUNTER_CV_WRITES_FAILED] = cvOutput.failedWrites();
+#if CV_OUTPUT == CV_OUTPUT_SPI_DMA
+    values[TELEMETRY_COUNTER_DMA_FRAMES] = cvOutput.frames;
+    values[TELEMETRY_COUNTER_DMA_SKIPPED] = cvOutput.skipped;
+    values[TELEMETRY_COUNTER_DMA_LAST_NS] = (uint32_t)((uint64_t)cvOutput.lastCycles * 1000 / (F_CPU_ACTUAL / 1000000));
+    values[TELEMETRY_COUNTER_DMA_WORST_NS] = (uint32_t)((uint64_t)cvOutput.worstCycles * 1000 / (F_CPU_ACTUAL / 1000000));
+#else
+    values[TELEMETRY_COUNTER_DMA_FRAMES] = 0;
+    values[TELEMETRY_COUNTER_DMA_SKIPPED] = 0;
+    values[TELEMETRY_COUNTER_DMA_LAST_NS] = 0;
+    values[TELEMETRY_COUNTER_DMA_WORST_NS] = 0;
+#endif
+    for (int i = 0; i < NUM_EVENT_SOURCES; i++) {
+      values[TELEMETRY_COUNTER_INPUT_FILTERED + i] = inputQueue.sources[i].filtered;
+      values[TELEMETRY_COUNTER_INPUT_LATENCY + i] = inputQueue.averageLatency(i);
+      values[TELEMETRY_COUNTER_INPUT_LATENCY_MAX + i] = inputQueue.sources[i].latencyMax;
+    }
+    values[TELEMETRY_COUNTER_I2C_MUX_SELECTS] = i2cBus.stats.muxSelects;
+    values[TELEMETRY_COUNTER_I2C_MUX_SKIPPED] = i2cBus.stats.muxSkipped;
+    values[TELEMETRY_COUNTER_OUTPUT_LATENCY] = schedule.latency;
+    values[TELEMETRY_COUNTER_ONSET_BEST] = schedule.bestOnset;
+    values[TELEMETRY_COUNTER_GATE_FAILED] = gateOutput.failed;
+    values[TELEMETRY_COUNTER_GATE_RETRIGGERS] = gateOutput.retriggers;
+    values[TELEMETRY_COUNTER_IDLE_MS] = (uint32_t)(idleCycles / (F_CPU_ACTUAL / 1000));
+    values[TELEMETRY_COUNTER_STARTUP_LISTENING] = startup.listening;
+    values[TELEMETRY_COUNTER_STARTUP_FIRST_VOICE] = startup.firstVoice;
+    values[TELEMETRY_COUNTER_STARTUP_ALL_VOICES] = startup.allVoices;
+    values[TELEMETRY_COUNTER_NOTES_MASKED] = startup.notesMasked;
+    values[TELEMETRY_COUNTER_CV_VALUE] = analogInput.read(ANALOG_LFO_CV);
+    values[TELEMETRY_COUNTER_CV_LOWEST] = analogInput.lowest[ANALOG_LFO_CV];
+    values[TELEMETRY_COUNTER_CV_HIGHEST] = analogInput.highest[ANALOG_LFO_CV];
+    for (int p = 0; p < I2C_PRIORITIES; p++) {
+      values[TELEMETRY_COUNTER_I2C_WAIT + p] = i2cBus.averageWait(p);
+      values[TELEMETRY_COUNTER_I2C_WAIT_MAX + p] = i2cBus.stats.waitMax[p];
+    }
+    length = telemetry.counters(values, TELEMETRY_COUNTERS_COUNT, now);
+  } else if (trace.total != telemetryTraceSent && now - telemetryTraceAt >= TELEMETRY_TRACE_US) {
+    telemetryTraceAt = now;
+    length = telemetry.trace(trace, telemetryTraceSent, now);
+    telemetryTraceSent = trace.total;
+  } else if (now - telemetryHistogramAt >= TELEMETRY_HISTOGRAM_US / TELEMETRY_HISTOGRAMS) {
+    telemetryHistogramAt = now;
+    const BudgetMonitor* monitors[TELEMETRY_HISTOGRAMS] = { &loopBudget, &tickBudget, &schedule.onset, &gateOutput.skew, &wakeLatency };
+    length = telemetry.histogram(telemetryHistogram, *monitors[telemetryHistogram], now);
+    telemetryHistogram = (telemetryHistogram + 1) % TELEMETRY_HISTOGRAMS;
+  } else if (now - telemetryTaskAt >= TELEMETRY_TASK_US) {
+    telemetryTaskAt = now;
+    length = telemetry.tasks(scheduler, now);
+  } else {
+    return false;
+  }
+  loopWork |= WORK_TELEMETRY;
+  if (Serial.availableForWrite() >= length) {
+    Serial.write(telemetry.frame, length);
+    telemetry.sent++;
+  } else {
+    telemetry.dropped++;
+  }
+  telemetry.spent(ARM_DWT_CYCCNT - start);
+  return true;
 }
 
-void sustainNotes() {
-  for (int i = 0; i < NUM_VOICES; i++) {
-    if (voices[i].noteOn == true) {
-      voices[i].sustained = true;
+// ------------------------ Input ingest
+// Messages are timestamped as they are read, DIN ones moved back by the
+// bytes that came in behind them (see EventQueue.h). Channel messages go to
+// the merged queue, clock and SysEx are handled right here so their timing
+// and buffers are not held up behind notes.
+template <class Port>
+FASTRUN void ingestMidi(Port& port, uint8_t source) {
+  for (int n = 0; n < INGEST_BURST && port.read(); n++) {
+    uint32_t now = source == EVENT_SOURCE_DIN ? dinArrival(micros(), Serial1.available()) : micros();
+    uint8_t type = port.getType();
+    if (type >= midi::SystemExclusive) {
+      if (!inputQueue.accepts(source, type, 0)) {
+        continue;
+      }
+
+      // ------------------ MIDI clock (system realtime, no channel)
+      if (type == midi::Clock) {
+        midiClock.tick(now);
+        midiTempo = midiClock.tempo() / 100;
+      }
+      if (type == midi::Start) {
+        midiClock.start(now);
+      }
+      if (type == midi::Continue) {
+        midiClock.cont(now);
+      }
+      if (type == midi::Stop) {
+        midiClock.stop();
+      }
+
+      // ------------------ SysEx dump/load
+      if (type == midi::SystemExclusive) {
+        sysex.receive(port.getSysExArray(), port.getSysExArrayLength());
+      }
+      continue;
+    }
+    if (type < midi::NoteOff) {
+      continue;
+    }
+
+    MidiEvent event;
+    event.time = now;
+    event.source = source;
+    event.type = type;
+    event.channel = port.getChannel();
+    event.data1 = port.getData1();
+    event.data2 = port.getData2();
+    if (event.type == midi::NoteOn && event.data2 == 0) {
+      event.type = midi::NoteOff;
     }
-    
+    inputQueue.push(event);
   }
 }
 
+// ****************************************************************
+// *************************** OUTPUT *****************************
+// ****************************************************************
 
-MIDI_CREATE_INSTANCE(HardwareSerial, Serial1,  MIDI);
+FASTRUN void controlTick() {
+  // A tuning change only ever takes effect between two output passes
+  tuningSwap();
+  if (schedule.adopt()) {
+    engine = stagedEngine;
+  }
 
-// ************************************************
-// ******************** SETUP *********************
-// ************************************************
+  // A play mode change routes Note Offs elsewhere from now on, so keys
+  // pressed before it would never reach the engine that sounds them
+  if (patch.playMode != player.mode) {
+    engine.releaseKeys();
+    if (schedule.staged) {
+      stagedEngine.releaseKeys();
+    }
+  }
+
+  // Arpeggiator and sequencer notes start on this tick. A batch staged but
+  // not yet written gets them too, it replaces the engine when it commits.
+  midiClock.poll(micros());
+  uint8_t played = player.tick(patch, midiClock, micros(), 1000000 / CONTROL_RATE_HZ);
+  for (int i = 0; i < played; i++) {
+    engine.handleEvent(player.events[i], millis());
+    if (schedule.staged) {
+      stagedEngine.handleEvent(player.events[i], millis());
+    }
+  }
 
-void setup() {
-	Serial.begin(9600);
-  MIDI.begin(MIDI_CHANNEL);
+  // Tempo-synced LFO: one triangle cycle per quarter note, depth on modwheel.
+  // Over budget it only moves every other tick (level 1) or holds (level 2).
+  controlTicks++;
+  if (degrader.level == 0 || (degrader.level == 1 && (controlTicks & 1))) {
+    engine.updateLfo(midiClock.phase(micros()));
+  }
+  // External LFO: the latest block mean, whatever rate the ADC runs at.
+  // Every tick, so depth 0 takes the offset back to none.
+  engine.updateCvLfo(analogInput.read(ANALOG_LFO_CV));
+  // Pressure from any number of messages since the last tick, one step each
+  engine.smoothPressure();
+  engine.glide();
+  // A staged batch ticks along with the engine it replaces, so adopting it
+  // keeps the LFOs, pressure and glide where the ticks took them. Its frame
+  // was rendered when it was armed, the commit timer only reads that.
+  if (schedule.staged) {
+    stagedEngine.lfoSemitones = engine.lfoSemitones;
+    stagedEngine.cvSemitones = engine.cvSemitones;
+    stagedEngine.smoothPressure();
+    stagedEngine.glide();
+  }
+  engine.tuning = activeTuning;
+  engine.render();
+  // While a batch is staged its frame goes out from the commit timer
+  if (!schedule.staged) {
+    cvOutput.frame(engine.voices, NUM_VOICES, micros());
+    frameWritten(engine.gates);
+    if (onsetPending) {
+      onsetPending = false;
+      schedule.recordOnset(micros() - onsetTime);
+    }
+  }
+  // Gates follow the pitch they open on by one tick, all in one port write
+  gateOutput.update(engine.voices, engine.gates, cvOutput.newestFrame(), gateWriteComplete);
 }
 
 // ************************************************
-// ******************** MAIN **********************
+// ******************** TASKS *********************
 // ************************************************
+// Each returns whether it found work. The table below is in priority
+// order: input and the control tick first, everything the player would not
+// hear a pass late behind TASK_BACKGROUND.
 
-void loop() {
-
-  if (MIDI.read()) {
+FASTRUN bool ingestTask() {
+  ingestMidi(MIDI, EVENT_SOURCE_DIN);
+  ingestMidi(usbMIDI, EVENT_SOURCE_USB);
+  return !inputQueue.empty();
+}
 
-    // -------------------- Note On
-    if (MIDI.getType() == midi::NoteOn && MIDI.getChannel() == MIDI_CHANNEL) {
-      midiNote = MIDI.getData1();
-      velocity = MIDI.getData2();
-      noteOn(midiNote, velocity);
-      for (int i = 0; i < NUM_VOICES; i++) {
-        
+// ------------------ Dispatch in time order, whichever port it came from
+FASTRUN bool dispatchTask() {
+  uint16_t before = loopEvents;
+  schedule.setLatency(patch.outputLatency);
+  if (schedule.latency == 0 && !schedule.staged) {
+    while (!inputQueue.empty()) {
+      if (!onsetPending) {
+        onsetPending = true;
+        onsetTime = inputQueue.front().time;
       }
+      handleEvent(engine, inputQueue.front());
+      inputQueue.pop(micros());
+      loopWork |= WORK_EVENTS;
+      loopEvents++;
+    }
+  } else {
+    // Scheduled: what is due shortly goes into the staged engine, rendered
+    // now and written by the commit timer at ingest time + latency
+    if (schedule.adopt()) {
+      engine = stagedEngine;
     }
-    
-    // -------------------- Note Off
-    if (MIDI.getType() == midi::NoteOff && MIDI.getChannel() == MIDI_CHANNEL) {
-      midiNote = MIDI.getData1();
-        noteOff(midiNote);
-      for (int i = 0; i < NUM_VOICES; i++) {
-        
+    bool batchStarted = false;
+    while (!inputQueue.empty()) {
+      // Pressure and arpeggiator keys are only read by the control tick, so
+      // with no batch open they go straight to the engine instead of costing
+      // a scheduled frame per message
+      const MidiEvent& front = inputQueue.front();
+      if (!schedule.staged && tickOnlyEvent(front)) {
+        handleEvent(engine, front);
+        inputQueue.pop(micros());
+        loopWork |= WORK_EVENTS;
+        loopEvents++;
+        continue;
       }
+      if (!schedule.take(front, micros())) {
+        break;
+      }
+      if (!batchStarted) {
+        batchStarted = true;
+        stagedEngine = engine;
+      }
+      handleEvent(stagedEngine, inputQueue.front());
+      inputQueue.pop(micros());
+      loopWork |= WORK_EVENTS;
+      loopEvents++;
     }
-
-    // ------------------ Pitchbend 
-    if (MIDI.getType() == midi::PitchBend && MIDI.getChannel() == MIDI_CHANNEL) {
-      pitchBendVolts = MIDI.getData2() << 7 | MIDI.getData1(); // already 14 bits = Volts out
-      pitchBendFreq = map((MIDI.getData2() << 7 | MIDI.getData1()), 0, 16383, PITCH_BEND_RANGE, 0 - PITCH_BEND_RANGE);
-      
+    if (schedule.staged && !schedule.armed) {
+      stagedEngine.tuning = activeTuning;
+      stagedEngine.render();
+      int32_t wait = schedule.arm(micros());
+      if (wait > 0) {
+        commitTimer.begin(commitTimerInterrupt, wait);
+      } else {
+        commitStagedFrame();
+      }
     }
+  }
+  return loopEvents != before;
+}
 
-    // ------------------ Aftertouch 
-    if (MIDI.getType() == midi::AfterTouchChannel && MIDI.getChannel() == MIDI_CHANNEL) {
-      aftertouch = MIDI.getData1();
-    }
+// ------------------ CV inputs: one filled half buffer per ANALOG_BLOCK samples
+FASTRUN bool analogTask() {
+  if (!lfoCvDma.interrupted()) {
+    return false;
+  }
+  analogInput.block(ANALOG_LFO_CV, lfoCvDma.bufferLastISRFilled(), micros());
+  lfoCvDma.clearInterrupt();
+  return true;
+}
 
-    // ------------------ Modwheel 
-    if (MIDI.getType() == midi::ControlChange && MIDI.getData1() == 1 && MIDI.getChannel() == MIDI_CHANNEL) {
-      modulationWheel = MIDI.getData2();
-		}
-
-		// ------------------ Sustain
-    if (MIDI.getType() == midi::ControlChange && MIDI.getData1() == 64 && MIDI.getChannel() == MIDI_CHANNEL) {
-      sustainPedal = MIDI.getData2();
-      if (sustainPedal > 63) {
-        susOn = true;
-        sustainNotes();
-      } 
-      if (sustainPedal <= 63) {
-        susOn = false;
-        unsustainNotes();
-      }
+// ------------------ Control tick: outputs are computed and written at a fixed rate
+FASTRUN bool tickTask() {
+  if (!controlTickDue || idle) {
+    return false;
+  }
+  controlTickDue = false;
+  loopWork |= WORK_TICK;
+  uint32_t tickStart = ARM_DWT_CYCCNT;
+  controlTick();
+  uint32_t tickCycles = ARM_DWT_CYCCNT - tickStart;
+  bool tickOverrun = tickBudget.record(tickCycles);
+  if (tickOverrun) {
+    trace.log(micros(), TRACE_TICK_OVERRUN, loopWork, degrader.level, tickCycles);
+  }
+  if (degrader.update(tickOverrun || loopOverrun)) {
+    trace.log(micros(), TRACE_DEGRADE, loopWork, degrader.level, tickCycles);
+  }
+  loopOverrun = false;
+  return true;
+}
+
+// ------------------ Front panel: ports are only read after INTA/INTB fired
+bool panelTask() {
+  if (!panelReady) {
+    // Expander setup from setup(): no answer leaves the panel off, as if
+    // none were fitted
+    if (!panelReadDone) {
+      return false;
+    }
+    panelReadDone = false;
+    panelReadPending = false;
+    if (panelReadOk) {
+      pinMode(PANEL_INTA_PIN, INPUT_PULLUP);
+      pinMode(PANEL_INTB_PIN, INPUT_PULLUP);
+      attachInterrupt(digitalPinToInterrupt(PANEL_INTA_PIN), panelInterrupt, FALLING);
+      attachInterrupt(digitalPinToInterrupt(PANEL_INTB_PIN), panelInterrupt, FALLING);
+      panel.begin((uint16_t)~(panelReadBuffer[0] | panelReadBuffer[1] << 8), micros());
+      panelReady = true;
+    }
+    return true;
+  }
+  uint8_t before = loopWork;
+  if (panelChanged && !panelReadPending) {
+    if (i2cBus.readRegister(I2C_PRIORITY_PANEL, I2C_NO_MUX, PANEL_MCP_ADDRESS, MCP23017_GPIOA, panelReadBuffer, 2, panelReadComplete)) {
+      panelChanged = false;
+      panelReadPending = true;
+      loopWork |= WORK_PANEL;
     }
+  }
+  if (panelReadDone) {
+    panelReadDone = false;
+    panelReadPending = false;
+    loopWork |= WORK_PANEL;
+    if (panelReadOk) {
+      panel.sample((uint16_t)~(panelReadBuffer[0] | panelReadBuffer[1] << 8), micros());
+    } else {
+      panelChanged = true;
+    }
+  }
+  panel.update(micros(), inputQueue);
+  return loopWork != before;
+}
 
-    // ------------------ MIDI CC
-    if (MIDI.getType() == midi::ControlChange && MIDI.getChannel() == MIDI_CHANNEL) {
-      knobNumber = MIDI.getData1();
-      knobValue = MIDI.getData2();
-      if (knobNumber >69 && knobNumber <88) {
-        // ...
-      }
+// ------------------ Scala text arrived over SysEx: build the next tuning table
+bool tuningTask() {
+  if (!scalaTextReady) {
+    return false;
+  }
+  scalaTextReady = false;
+  loopWork |= WORK_TUNING;
+  scalaText[sizeof(scalaText) - 1] = 0;
+  const char* keyboardText = scalaText + strlen(scalaText) + 1;
+  if (scalaParseScale(scalaText, scalaScale)) {
+    if (keyboardText >= scalaText + sizeof(scalaText) || !scalaParseKeyboard(keyboardText, scalaKeyboard)) {
+      scalaDefaultKeyboard(scalaKeyboard);
     }
+    TuningTable& table = tuningBackBuffer();
+    tuningBuild(scalaScale, scalaKeyboard, table);
+    tuningSchedule(table);
+  }
+  return true;
+}
+
+// ------------------ SysEx dump, one message per pass while the UART has room
+bool sysexTask() {
+  if (!sysex.txPending() || Serial1.availableForWrite() < SYSEX_MAX_MESSAGE) {
+    return false;
   }
+  loopWork |= WORK_SYSEX;
+  uint8_t sysexMessage[SYSEX_MAX_MESSAGE];
+  unsigned sysexLength = sysex.nextMessage(sysexMessage);
+  MIDI.sendSysEx(sysexLength, sysexMessage, true);
+  return true;
+}
 
-  // ****************************************************************
-  // *************************** OUTPUT *****************************
-  // ****************************************************************
+// ------------------ Output bring-up: voices join the allocator as they get ready
+bool startupTask() {
+  // Once, as soon as a frame went out with a gate open
+  if (startup.firstNote != 0 && !firstNoteShown) {
+    firstNoteShown = true;
+    Serial.print("First note at us: ");
+    Serial.println(startup.firstNote);
+    return true;
+  }
+  if (startup.complete()) {
+    return false;
+  }
+  uint32_t now = micros();
+  uint32_t ready = cvOutput.bringUp(now);
+  if (!startup.voicesReady(ready, cvOutput.absentVoices(), now)) {
+    return false;
+  }
+  engine.voiceMask = startup.voiceMask;
+  stagedEngine.voiceMask = startup.voiceMask;
+  return true;
+}
 
-  for (int i = 0; i < NUM_VOICES; i++) {
-    // Calculate pitchbender factor
-    midiNoteVoltage = noteVolt[voices[i].midiNote];
-    double pitchBendPosition = (double)pitchBendFreq / (double)16383 * 2.0;
-    double factor = pow(2.0, pitchBendPosition / 12.0);
-    voices[i].bentNoteVolts = midiNoteVoltage * factor;
-    voices[i].bentNoteFreq = noteFrequency[i] * factor;
-    if (voices[i].bentNoteVolts < 0) {
-      voices[i].bentNoteVolts = 0;
-    }
-    if (voices[i].bentNoteVolts > 16383) {
-      voices[i].bentNoteVolts = 16383;
-    }
-    //
-  }	
+bool busStatsTask() {
+  i2cBus.updateStats(micros());
+  return true;
+}
+
+FASTRUN uint32_t cycleCount() {
+  return ARM_DWT_CYCCNT;
+}
+
+// Panel, SysEx and telemetry wait while the loop is over budget
+constexpr Task loopTasks[] = {
+  // name         run            period µs               priority            maxDegrade
+  { "ingest",     ingestTask,    0,                      0,                  DEGRADE_MAX },
+  { "dispatch",   dispatchTask,  0,                      1,                  DEGRADE_MAX },
+  { "analog",     analogTask,    0,                      2,                  DEGRADE_MAX },
+  { "tick",       tickTask,      0,                      3,                  DEGRADE_MAX },
+  { "panel",      panelTask,     0,                      4,                  0 },
+  { "startup",    startupTask,   STARTUP_STEP_US,        5,                  DEGRADE_MAX },
+  { "tuning",     tuningTask,    0,                      TASK_BACKGROUND,    DEGRADE_MAX },
+  { "sysex",      sysexTask,     0,                      TASK_BACKGROUND + 1, 0 },
+  { "telemetry",  sendTelemetry, 0,                      TASK_BACKGROUND + 2, 0 },
+  { "busStats",   busStatsTask,  BUS_STATS_US,           TASK_BACKGROUND + 3, DEGRADE_MAX },
+};
+#define NUM_LOOP_TASKS (sizeof(loopTasks) / sizeof(loopTasks[0]))
+static_assert(tasksInPriorityOrder(loopTasks, NUM_LOOP_TASKS), "loop tasks must be listed in priority order");
+static_assert(NUM_LOOP_TASKS <= 32, "one work bit per task");
+TaskStats loopTaskStats[NUM_LOOP_TASKS];
+
+// ************************************************
+// ******************** SETUP *********************
+// ************************************************
+
+FLASHMEM void setup() {
+	Serial.begin(115200);   // USB, the rate is ignored
+  // Channel filtering is done per source by the input queue
+  MIDI.begin(MIDI_CHANNEL_OMNI);
+  inputQueue.begin();
+  inputQueue.setFilter(EVENT_SOURCE_DIN, 1 << (MIDI_CHANNEL - 1), EVENT_TYPES_ALL);
+  inputQueue.setFilter(EVENT_SOURCE_USB, 1 << (MIDI_CHANNEL - 1), EVENT_TYPES_ALL);
+  midiClock.reset();
+  patchDefaults();
+  calibrationDefaults();
+  tuningEqual(tuningTables[0]);
+  startup.begin(NUM_VOICES);
+  engine.begin(&patch, &calibration, activeTuning);
+  engine.voiceMask = startup.voiceMask;   // voices join as their outputs come up
+  stagedEngine = engine;
+  schedule.begin(patch.outputLatency);
+  scalaTextDefaults();   // DMAMEM is not zeroed at startup
+  sequenceDefaults();
+  player.begin();
+  sysex.begin(sysexBlocks, sizeof(sysexBlocks) / sizeof(sysexBlocks[0]));
+  // Room for a few whole SysEx messages so dumps never wait on the UART
+  Serial1.addMemoryForWrite(sysexTxMemory, sizeof(sysexTxMemory));
+
+  // From here on Wire is only touched through the async bus queue, and
+  // nothing below waits for a device to answer
+  i2cBus.begin();
+
+  // Panel inputs are active low with pullups; INTA/INTB mirrored, any change.
+  // The port read after the setup also clears anything already latched, the
+  // panel task takes the panel into use once it is back.
+  const uint8_t panelConfig[2] = { MCP23017_IOCON, MCP23017_IOCON_MIRROR };
+  const uint8_t panelPullups[3] = { MCP23017_GPPUA, 0xFF, 0xFF };
+  const uint8_t panelInterrupts[3] = { MCP23017_GPINTENA, 0xFF, 0xFF };
+  i2cBus.write(I2C_PRIORITY_PANEL, I2C_NO_MUX, PANEL_MCP_ADDRESS, panelConfig, 2);
+  i2cBus.write(I2C_PRIORITY_PANEL, I2C_NO_MUX, PANEL_MCP_ADDRESS, panelPullups, 3);
+  i2cBus.write(I2C_PRIORITY_PANEL, I2C_NO_MUX, PANEL_MCP_ADDRESS, panelInterrupts, 3);
+  panelReadPending = i2cBus.readRegister(I2C_PRIORITY_PANEL, I2C_NO_MUX, PANEL_MCP_ADDRESS, MCP23017_GPIOA, panelReadBuffer, 2, panelReadComplete);
+
+#if CV_OUTPUT == CV_OUTPUT_SPI_DAC
+  cvOutput.begin(dacCsPin);
+#elif CV_OUTPUT == CV_OUTPUT_SPI_DMA
+  if (!cvOutput.begin(dacCsPin)) {
+    Serial.println("SPI DMA: a DAC chip select is not an LPSPI4 PCS pin, CV output off");
+  }
+#elif CV_OUTPUT == CV_OUTPUT_AD9833
+  cvOutput.begin(ddsFsyncPin);
+#elif CV_OUTPUT == CV_OUTPUT_ROUTED
+  cvOutput.first.begin(dacBanks);
+  cvOutput.second.begin(dacCsPin);
+  cvOutput.begin(voiceRoute);
+#else
+  cvOutput.begin(dacBanks);
+#endif
+  gateOutput.begin();
+
+  // 12 bit conversions back to back at ANALOG_SAMPLE_HZ, no hardware
+  // averaging: the blocks average in software and measure the noise
+  analogInput.begin();
+  adc.adc0->setResolution(ANALOG_ADC_BITS);
+  adc.adc0->setAveraging(1);
+  adc.adc0->setConversionSpeed(ADC_CONVERSION_SPEED::HIGH_SPEED);
+  adc.adc0->setSamplingSpeed(ADC_SAMPLING_SPEED::HIGH_SPEED);
+  lfoCvDma.init(&adc, ADC_0);
+  adc.adc0->startSingleRead(LFO_CV_PIN);
+  adc.adc0->startTimer(ANALOG_SAMPLE_HZ);
+
+  loopBudget.begin(LOOP_BUDGET_US * (F_CPU_ACTUAL / 1000000), BUDGET_BUCKET_SHIFT);
+  tickBudget.begin(TICK_BUDGET_US * (F_CPU_ACTUAL / 1000000), BUDGET_BUCKET_SHIFT);
+  degrader.begin();
+  trace.clear();
+  telemetry.begin(TELEMETRY_CPU_PERMILLE, ARM_DWT_CYCCNT);
+  wakeLatency.begin(WAKE_BUDGET_US, WAKE_BUCKET_SHIFT);
+  scheduler.begin(loopTasks, loopTaskStats, NUM_LOOP_TASKS, cycleCount, F_CPU_ACTUAL / 1000000, micros());
+  commitTimer.priority(64);
+  controlTimer.begin(controlTimerInterrupt, 1000000 / CONTROL_RATE_HZ);
+  startup.listening = micros();
 }
 
+// ************************************************
+// ******************** MAIN **********************
+// ************************************************
+
+FASTRUN void loop() {
+  uint32_t loopStart = ARM_DWT_CYCCNT;
+  loopWork = 0;
+  loopEvents = 0;
+
+  scheduler.run(micros(), degrader.level);
+
+  // ------------------ Loop budget
+  uint32_t loopCycles = ARM_DWT_CYCCNT - loopStart;
+  if (loopBudget.record(loopCycles)) {
+    loopOverrun = true;
+    trace.log(micros(), TRACE_LOOP_OVERRUN, loopWork, loopEvents, loopCycles);
+  }
+
+  // ------------------ Idle: no control ticks, sleep between interrupts.
+  // Work found after a wake restarts the tick timer and runs a tick on the
+  // next pass, so the first frame is one loop pass behind the wake.
+  bool quiet = systemQuiet();
+  if (!quiet) {
+    lastBusy = micros();
+  }
+  if (idle && !quiet) {
+    idle = false;
+    wakePending = true;
+    controlTimer.begin(controlTimerInterrupt, 1000000 / CONTROL_RATE_HZ);
+    adc.adc0->startTimer(ANALOG_SAMPLE_HZ);
+    controlTickDue = true;
+  } else if (!idle && quiet && micros() - lastBusy >= IDLE_HOLDOFF_US) {
+    idle = true;
+    idleEntries++;
+    controlTimer.end();
+    // Nothing reads the CV inputs while idle, their DMA would wake WFI
+    adc.adc0->stopTimer();
+    controlTickDue = false;
+  }
+  if (idle) {
+    idleSleep();
+  }
+}
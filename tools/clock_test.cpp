@@ -0,0 +1,279 @@
+// Host test for the MIDI clock tracker (src/MidiClock.cpp): feeds it
+// synthetic 24 PPQN streams with jittered arrival times and measures how it
+// locks.
+//
+//   g++ -std=c++14 -O2 -Iinclude tools/clock_test.cpp src/MidiClock.cpp src/Player.cpp src/Settings.cpp -o clock_test
+//   ./clock_test [--seed n] [--beats n] [--max-phase-us n] [--max-converge-ms n]
+//
+// Every stream starts with Start, then ticks at an exact period moved by
+// uniform jitter of up to +-j µs; time starts just below the micros() wrap.
+// phase() is sampled every millisecond like the control tick reads it and
+// compared with the phase of the unjittered stream. One line per stream:
+//   converge   ms from the first tick (or from the tempo step) until tempo
+//              stays within 0.5 % and phase within 1 ms for the rest
+//   phase      RMS and worst phase error in µs after convergence
+//   tempo      worst tempo error after convergence, in 1/100 BPM
+//   reseeds    times the loop restarted from a raw interval
+// The step streams jump from 120 to 140 BPM halfway through.
+// A last stream at 120 BPM delivers every downbeat 3 ms late, so phase()
+// holds at the end of the 24th tick; the beat position (beatCount plus
+// phase) must never move backward, or the player would retrigger a step.
+// The dropout check runs the sequencer from a 120 BPM clock that stops after
+// a few beats: the lock must drop MIDI_CLOCK_TIMEOUT_TICKS periods after the
+// last tick, and the player must go on stepping at its internal tempo.
+// --max-phase-us / --max-converge-ms  exit status 1 if any stream's RMS phase
+//        error or convergence time is larger, or a stream never converges
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "MidiClock.h"
+#include "Player.h"
+#include "Settings.h"
+
+#define CLOCK_TEST_BEATS 64
+#define CLOCK_TEST_START_US 0xFFF00000u
+#define CONVERGED_TEMPO 0.005
+#define CONVERGED_PHASE_US 1000.0
+#define LATE_DOWNBEAT_US 3000
+
+struct Stream {
+  uint32_t bpm;                // 1/100 BPM
+  uint32_t stepBpm;            // from the middle on, 0 = no step
+  uint32_t jitter;             // µs, +-
+};
+
+struct Sample {
+  double at;                   // µs since the first tick of its tempo
+  double phaseUs;
+  double tempo;                // error, 1/100 BPM
+  double trueTempo;
+  bool segment;                // after the tempo step
+};
+
+struct Result {
+  bool converged;
+  double convergeMs;
+  double phaseRms;
+  double phaseWorst;
+  double tempoWorst;
+  uint32_t reseeds;
+};
+
+static uint32_t random32 = 0x2545F491;
+
+static uint32_t nextRandom() {
+  random32 ^= random32 << 13;
+  random32 ^= random32 >> 17;
+  random32 ^= random32 << 5;
+  return random32;
+}
+
+// µs per tick at a tempo in 1/100 BPM
+static double tickPeriod(uint32_t bpm) {
+  return 60e6 * 100.0 / bpm / MIDI_CLOCK_PPQN;
+}
+
+static Result run(const Stream& stream, uint32_t beats) {
+  uint32_t ticks = beats * MIDI_CLOCK_PPQN;
+  uint32_t stepTick = stream.stepBpm ? ticks / 2 : ticks;
+  // Ideal tick times as offsets from the start, in double so they never
+  // drift, and the jittered arrivals
+  std::vector<double> ideal(ticks + 1);
+  std::vector<double> arrival(ticks);
+  for (uint32_t i = 0; i < ticks; i++) {
+    double period = tickPeriod(i < stepTick ? stream.bpm : stream.stepBpm);
+    ideal[i + 1] = ideal[i] + period;
+    int32_t jitter = stream.jitter ? (int32_t)(nextRandom() % (2 * stream.jitter + 1)) - (int32_t)stream.jitter : 0;
+    arrival[i] = ideal[i] + jitter > 0 ? ideal[i] + jitter : 0;
+  }
+
+  MidiClock clock;
+  clock.reset();
+  clock.start(CLOCK_TEST_START_US);
+  std::vector<Sample> samples;
+  double at = 0;
+  for (uint32_t i = 0; i < ticks; i++) {
+    clock.tick(CLOCK_TEST_START_US + (uint32_t)arrival[i]);
+    // Samples until the next tick arrives, against the unjittered stream
+    double until = i + 1 < ticks ? arrival[i + 1] : ideal[ticks];
+    for (; at < until; at += 1000) {
+      if (at < arrival[i]) {
+        continue;
+      }
+      uint32_t tick = i;
+      while (tick > 0 && at < ideal[tick]) {
+        tick--;
+      }
+      while (tick + 1 < ticks && at >= ideal[tick + 1]) {
+        tick++;
+      }
+      double period = ideal[tick + 1] - ideal[tick];
+      double beatsGone = (tick + (at - ideal[tick]) / period) / MIDI_CLOCK_PPQN;
+      uint32_t truePhase = (uint32_t)((beatsGone - floor(beatsGone)) * 4294967296.0);
+      int32_t error = (int32_t)(clock.phase(CLOCK_TEST_START_US + (uint32_t)at) - truePhase);
+      Sample sample;
+      sample.at = at - (tick >= stepTick ? ideal[stepTick] : 0);
+      sample.phaseUs = error / 4294967296.0 * MIDI_CLOCK_PPQN * period;
+      sample.tempo = (double)clock.tempo() - (tick < stepTick ? stream.bpm : stream.stepBpm);
+      sample.trueTempo = tick < stepTick ? stream.bpm : stream.stepBpm;
+      sample.segment = tick >= stepTick;
+      samples.push_back(sample);
+    }
+  }
+
+  // Converged from the sample after the last one out of bounds; with a step
+  // only the second tempo counts
+  Result result;
+  result.reseeds = clock.reseeds;
+  size_t converged = 0;
+  for (size_t k = 0; k < samples.size(); k++) {
+    const Sample& sample = samples[k];
+    if (sample.segment != (stream.stepBpm != 0)) {
+      converged = k + 1;
+    } else if (fabs(sample.tempo) > sample.trueTempo * CONVERGED_TEMPO || fabs(sample.phaseUs) > CONVERGED_PHASE_US) {
+      converged = k + 1;
+    }
+  }
+  result.converged = converged < samples.size();
+  result.convergeMs = result.converged ? samples[converged].at / 1000.0 : 0;
+  double sum = 0;
+  result.phaseWorst = 0;
+  result.tempoWorst = 0;
+  for (size_t k = converged; k < samples.size(); k++) {
+    sum += samples[k].phaseUs * samples[k].phaseUs;
+    result.phaseWorst = fmax(result.phaseWorst, fabs(samples[k].phaseUs));
+    result.tempoWorst = fmax(result.tempoWorst, fabs(samples[k].tempo));
+  }
+  result.phaseRms = result.converged ? sqrt(sum / (samples.size() - converged)) : 0;
+  return result;
+}
+
+// Samples every 100 µs; returns how many samples moved the beat position back
+static uint32_t runLateDownbeats(uint32_t beats) {
+  double period = tickPeriod(12000);
+  MidiClock clock;
+  clock.reset();
+  clock.start(CLOCK_TEST_START_US);
+  uint64_t last = 0;
+  uint32_t backward = 0;
+  double at = 0;
+  uint32_t ticks = beats * MIDI_CLOCK_PPQN;
+  for (uint32_t i = 0; i < ticks; i++) {
+    double arrival = i * period + (i > 0 && i % MIDI_CLOCK_PPQN == 0 ? LATE_DOWNBEAT_US : 0);
+    double next = (i + 1) * period + ((i + 1) % MIDI_CLOCK_PPQN == 0 ? LATE_DOWNBEAT_US : 0);
+    clock.tick(CLOCK_TEST_START_US + (uint32_t)arrival);
+    for (at = arrival; at < next; at += 100) {
+      uint64_t position = ((uint64_t)clock.beatCount << 32) + clock.phase(CLOCK_TEST_START_US + (uint32_t)at);
+      if (position < last) {
+        backward++;
+      }
+      last = position;
+    }
+  }
+  return backward;
+}
+
+// Control ticks every ms like the firmware's; false if the lock dropped at
+// the wrong time or the player stopped stepping without it
+static bool runDropout() {
+  const uint32_t tickUs = 1000;
+  double period = tickPeriod(12000);
+  patchDefaults();
+  patch.playMode = PLAY_MODE_SEQUENCE;
+  patch.stepsPerBeat = 4;
+  patch.internalTempo = 12000;
+  sequenceDefaults();
+  MidiClock clock;
+  clock.reset();
+  Player player;
+  player.begin();
+  clock.start(CLOCK_TEST_START_US);
+  uint32_t ticks = 4 * MIDI_CLOCK_PPQN;
+  double lastTick = (ticks - 1) * period;
+  double unlockedAt = -1;
+  uint32_t stepsUnlocked = 0;
+  uint32_t next = 0;
+  for (double at = 0; at < lastTick + 2e6; at += tickUs) {
+    uint32_t now = CLOCK_TEST_START_US + (uint32_t)at;
+    for (; next < ticks && next * period <= at; next++) {
+      clock.tick(CLOCK_TEST_START_US + (uint32_t)(next * period));
+    }
+    clock.poll(now);
+    uint32_t steps = player.steps;
+    player.tick(patch, clock, now, tickUs);
+    if (!clock.locked && next == ticks) {
+      if (unlockedAt < 0) {
+        unlockedAt = at;
+      }
+      stepsUnlocked += player.steps - steps;
+    }
+  }
+  double timeout = MIDI_CLOCK_TIMEOUT_TICKS * clock.tickPeriod();
+  double late = unlockedAt - lastTick;
+  printf("dropout: unlocked %.1f ms after the last tick (timeout %.1f ms), %u steps after\n", late / 1000.0, timeout / 1000.0, stepsUnlocked);
+  // The unlocked stretch is 2 s less the timeout, at 8 steps a second
+  uint32_t expected = (uint32_t)((2e6 - timeout) / 125000.0);
+  return unlockedAt >= 0 && late > timeout && late <= timeout + tickUs && !clock.running && stepsUnlocked + 1 >= expected;
+}
+
+int main(int argc, char** argv) {
+  uint32_t beats = CLOCK_TEST_BEATS;
+  double maxPhase = 0;
+  double maxConverge = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      random32 = atoi(argv[++i]);
+      if (random32 == 0) {
+        random32 = 1;
+      }
+    } else if (strcmp(argv[i], "--beats") == 0 && i + 1 < argc) {
+      beats = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--max-phase-us") == 0 && i + 1 < argc) {
+      maxPhase = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--max-converge-ms") == 0 && i + 1 < argc) {
+      maxConverge = atof(argv[++i]);
+    } else {
+      fprintf(stderr, "usage: clock_test [--seed n] [--beats n] [--max-phase-us n] [--max-converge-ms n]\n");
+      return 2;
+    }
+  }
+  if (beats < 4) {
+    fprintf(stderr, "clock_test: need at least 4 beats\n");
+    return 2;
+  }
+
+  // 320 µs is one DIN byte, the jitter a clock sharing the wire with notes sees
+  const Stream streams[] = {
+    { 6000, 0, 0 }, { 6000, 0, 320 }, { 6000, 0, 1000 },
+    { 12000, 0, 0 }, { 12000, 0, 100 }, { 12000, 0, 320 }, { 12000, 0, 1000 },
+    { 18000, 0, 320 }, { 30000, 0, 320 },
+    { 12000, 14000, 0 }, { 12000, 14000, 320 },
+  };
+  bool failed = false;
+  printf("   bpm    step  jitter   converge ms   phase rms/worst us   tempo worst   reseeds\n");
+  for (unsigned i = 0; i < sizeof(streams) / sizeof(streams[0]); i++) {
+    const Stream& stream = streams[i];
+    Result result = run(stream, beats);
+    printf("%6.1f  %6.1f  %6u", stream.bpm / 100.0, stream.stepBpm / 100.0, stream.jitter);
+    if (result.converged) {
+      printf("   %11.1f   %8.1f/%-9.1f   %11.1f   %7u\n", result.convergeMs, result.phaseRms, result.phaseWorst, result.tempoWorst, result.reseeds);
+    } else {
+      printf("   never\n");
+    }
+    if (!result.converged || (maxPhase > 0 && result.phaseRms > maxPhase) || (maxConverge > 0 && result.convergeMs > maxConverge)) {
+      failed = true;
+    }
+  }
+  uint32_t backward = runLateDownbeats(beats);
+  printf("late downbeats: %u backward steps\n", backward);
+  if (backward > 0) {
+    failed = true;
+  }
+  if (!runDropout()) {
+    failed = true;
+  }
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,739 @@
+// Offline CV renderer: plays Standard MIDI Files through the firmware's own
+// voice engine (src/VoiceEngine.cpp) and MIDI clock tracker, one independent
+// engine per file, files spread over all cores.
+//
+//   g++ -std=c++14 -O2 -pthread -Iinclude tools/cv_render.cpp src/VoiceEngine.cpp src/MidiClock.cpp src/Tuning.cpp src/Settings.cpp src/Schedule.cpp src/Budget.cpp -o cv_render
+//   ./cv_render [-j threads] [-o dir] [--rate hz] [--channel n] [--scl scale.scl [--kbm map.kbm]] [--max-cents c] [--jitter us] file.mid...
+//
+// Each file is rendered at the control tick rate (default 1000 Hz) into
+// <dir>/<name>.cv, written through a shared memory mapping:
+//   header   CvFileHeader (magic "DCO8CV", version, voices, rate, ticks)
+//   samples  ticks x voices CvSample, tick major, host byte order
+// The file's tempo map drives a simulated 24 PPQN clock into MidiClock, so the
+// LFO runs the same as with a sequencer sending clock from time zero.
+//
+// For every sounding voice and tick the frequency the CV code stands for is
+// compared with the pitch the engine meant to play (tuning table times bend
+// and LFO factor, and a mono voice's glide). Per file and in total: mean, RMS and worst error in cents,
+// plus the ticks where the target lies outside the C1-C7 CV range.
+// --channel  only play this MIDI channel (1-16), default all
+// --max-cents  exit status 1 if any in-range error is larger
+// --jitter  replays every Note On through a model of the firmware loop twice,
+//        immediate (output at the next control tick) and scheduled with this
+//        output latency (src/Schedule.cpp), and prints both onset histograms,
+//        measured from the time the note is in the file
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Budget.h"
+#include "MidiClock.h"
+#include "Schedule.h"
+#include "Settings.h"
+#include "Tuning.h"
+#include "VoiceEngine.h"
+
+#define RENDER_RATE_HZ 1000
+#define RENDER_TAIL_US 500000        // keep rendering after the last event
+#define RENDER_VERSION 1
+
+#define SAMPLE_NOTE_ON 1
+#define SAMPLE_KEY_DOWN 2
+#define SAMPLE_SUSTAINED 4
+
+struct CvFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t voices;
+  uint32_t rate;
+  uint32_t ticks;
+};
+
+struct CvSample {
+  uint16_t volts;                    // bentNoteVolts, 0..16383
+  uint16_t frequency;                // bentNoteFreq, Hz
+  uint8_t note;
+  uint8_t flags;                     // SAMPLE_*
+  uint16_t reserved;
+};
+
+// ------------------------ Standard MIDI File
+struct SongEvent {
+  uint64_t time;                     // µs from the start of the song
+  uint8_t status;
+  uint8_t data1;
+  uint8_t data2;
+};
+
+struct RawEvent {
+  uint32_t tick;
+  uint8_t status;
+  uint8_t data1;
+  uint8_t data2;
+  uint32_t tempo;                    // µs per quarter when status == 0xFF
+};
+
+struct TempoSegment {
+  double tick;
+  double micros;
+  double microsPerTick;
+};
+
+struct Song {
+  std::vector<SongEvent> events;
+  std::vector<uint64_t> clocks;      // 24 PPQN pulse times
+};
+
+static bool readLength(const std::vector<uint8_t>& data, size_t& pos, size_t end, uint32_t& value) {
+  value = 0;
+  for (int i = 0; i < 4; i++) {
+    if (pos >= end) {
+      return false;
+    }
+    uint8_t b = data[pos++];
+    value = (value << 7) | (b & 0x7F);
+    if ((b & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static uint32_t readBig(const std::vector<uint8_t>& data, size_t pos, int bytes) {
+  uint32_t value = 0;
+  for (int i = 0; i < bytes; i++) {
+    value = (value << 8) | data[pos + i];
+  }
+  return value;
+}
+
+static bool parseTrack(const std::vector<uint8_t>& data, size_t pos, size_t end, std::vector<RawEvent>& raw, std::string& error) {
+  uint32_t tick = 0;
+  uint8_t running = 0;
+  while (pos < end) {
+    uint32_t delta;
+    if (!readLength(data, pos, end, delta) || pos >= end) {
+      error = "truncated track";
+      return false;
+    }
+    tick += delta;
+    uint8_t status = data[pos];
+    if (status & 0x80) {
+      pos++;
+    } else if (running != 0) {
+      status = running;
+    } else {
+      error = "data byte without running status";
+      return false;
+    }
+
+    if (status == 0xFF) {
+      if (pos >= end) {
+        error = "truncated meta event";
+        return false;
+      }
+      uint8_t type = data[pos++];
+      uint32_t length;
+      if (!readLength(data, pos, end, length) || pos + length > end) {
+        error = "truncated meta event";
+        return false;
+      }
+      if (type == 0x51 && length == 3) {
+        RawEvent event = { tick, 0xFF, 0, 0, readBig(data, pos, 3) };
+        raw.push_back(event);
+      }
+      pos += length;
+      if (type == 0x2F) {
+        break;
+      }
+      running = 0;
+    } else if (status == 0xF0 || status == 0xF7) {
+      uint32_t length;
+      if (!readLength(data, pos, end, length) || pos + length > end) {
+        error = "truncated SysEx";
+        return false;
+      }
+      pos += length;
+      running = 0;
+    } else if (status >= 0xF0) {
+      error = "unexpected system message";
+      return false;
+    } else {
+      running = status;
+      int dataBytes = ((status & 0xE0) == 0xC0) ? 1 : 2;
+      if (pos + dataBytes > end) {
+        error = "truncated channel message";
+        return false;
+      }
+      RawEvent event = { tick, status, data[pos], 0, 0 };
+      if (dataBytes == 2) {
+        event.data2 = data[pos + 1];
+      }
+      pos += dataBytes;
+      raw.push_back(event);
+    }
+  }
+  return true;
+}
+
+static double tickToMicros(const std::vector<TempoSegment>& tempo, double tick) {
+  size_t n = tempo.size() - 1;
+  while (n > 0 && tempo[n].tick > tick) {
+    n--;
+  }
+  return tempo[n].micros + (tick - tempo[n].tick) * tempo[n].microsPerTick;
+}
+
+static bool loadSong(const char* path, int channel, Song& song, std::string& error) {
+  std::vector<uint8_t> data;
+  FILE* file = fopen(path, "rb");
+  if (file == 0) {
+    error = "cannot open";
+    return false;
+  }
+  uint8_t buffer[65536];
+  size_t length;
+  while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    data.insert(data.end(), buffer, buffer + length);
+  }
+  fclose(file);
+
+  if (data.size() < 14 || memcmp(&data[0], "MThd", 4) != 0 || readBig(data, 4, 4) < 6) {
+    error = "not a Standard MIDI File";
+    return false;
+  }
+  uint32_t tracks = readBig(data, 10, 2);
+  uint32_t division = readBig(data, 12, 2);
+  size_t pos = 8 + readBig(data, 4, 4);
+
+  std::vector<RawEvent> raw;
+  for (uint32_t track = 0; track < tracks && pos + 8 <= data.size(); ) {
+    uint32_t chunkLength = readBig(data, pos + 4, 4);
+    size_t start = pos + 8;
+    size_t end = start + chunkLength;
+    if (end > data.size()) {
+      error = "truncated chunk";
+      return false;
+    }
+    if (memcmp(&data[pos], "MTrk", 4) == 0) {
+      if (!parseTrack(data, start, end, raw, error)) {
+        return false;
+      }
+      track++;
+    }
+    pos = end;
+  }
+  // Stable in file order, so format 1 tracks merge like a sequencer plays them
+  std::stable_sort(raw.begin(), raw.end(), [](const RawEvent& a, const RawEvent& b) { return a.tick < b.tick; });
+
+  std::vector<TempoSegment> tempo;
+  bool smpte = (division & 0x8000) != 0;
+  double ticksPerQuarter = division;
+  if (smpte) {
+    // Fixed tick length, the clock runs at 120 BPM
+    double ticksPerSecond = (double)(256 - (division >> 8)) * (division & 0xFF);
+    TempoSegment segment = { 0, 0, 1000000.0 / ticksPerSecond };
+    tempo.push_back(segment);
+    ticksPerQuarter = ticksPerSecond / 2;
+  } else {
+    if (division == 0) {
+      error = "zero division";
+      return false;
+    }
+    TempoSegment segment = { 0, 0, 500000.0 / division };
+    tempo.push_back(segment);
+  }
+
+  uint32_t lastTick = 0;
+  for (size_t i = 0; i < raw.size(); i++) {
+    const RawEvent& event = raw[i];
+    lastTick = event.tick;
+    if (event.status == 0xFF) {
+      if (!smpte) {
+        TempoSegment segment = { (double)event.tick, tickToMicros(tempo, event.tick), (double)event.tempo / division };
+        if (tempo.back().tick == segment.tick) {
+          tempo.back() = segment;
+        } else {
+          tempo.push_back(segment);
+        }
+      }
+      continue;
+    }
+    if (channel != 0 && (event.status & 0x0F) != channel - 1) {
+      continue;
+    }
+    SongEvent songEvent;
+    songEvent.time = (uint64_t)(tickToMicros(tempo, event.tick) + 0.5);
+    songEvent.status = event.status & 0xF0;
+    songEvent.data1 = event.data1;
+    songEvent.data2 = event.data2;
+    // Same as ingest: Note On with velocity 0 is a Note Off
+    if (songEvent.status == EVENT_TYPE_NOTE_ON && songEvent.data2 == 0) {
+      songEvent.status = EVENT_TYPE_NOTE_OFF;
+    }
+    song.events.push_back(songEvent);
+  }
+
+  for (uint32_t pulse = 0; ; pulse++) {
+    double tick = pulse * ticksPerQuarter / MIDI_CLOCK_PPQN;
+    if (tick > lastTick) {
+      break;
+    }
+    song.clocks.push_back((uint64_t)(tickToMicros(tempo, tick) + 0.5));
+  }
+  return true;
+}
+
+// ------------------------ Rendering
+struct RenderStats {
+  uint32_t ticks;
+  uint32_t notes;
+  uint64_t sounding;                 // voice-ticks with a note on
+  uint64_t outOfRange;               // target outside the CV span
+  double sumCents;                   // absolute
+  double sumSquares;
+  double worstCents;                 // signed, largest magnitude
+  uint8_t worstNote;
+  uint32_t worstTick;
+};
+
+struct RenderJob {
+  const char* path;
+  std::string outputPath;
+  bool ok;
+  std::string error;
+  RenderStats stats;
+  BudgetMonitor immediate;           // --jitter onsets, µs
+  BudgetMonitor scheduled;
+  uint32_t late;
+};
+
+struct RenderSettings {
+  uint32_t rate;
+  int channel;
+  const TuningTable* tuning;
+  int32_t jitterLatency;             // -1 = no jitter replay
+};
+
+// ------------------------ Onset jitter replay
+// Loop passes run back to back with lengths drawn from a fixed mix: mostly
+// 10-40 µs, 15 % 40-160 µs (panel, SysEx, clock bursts) and 5 % 160-400 µs
+// (tuning builds, passes over budget). Input is read at the start of a pass,
+// a due control tick and its output happen at the end of it. Both modes see
+// the same passes.
+struct LoopModel {
+  uint32_t state;
+
+  uint32_t pass() {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    uint32_t r = state % 1000;
+    if (r < 800) {
+      return 10 + r % 31;
+    }
+    if (r < 950) {
+      return 40 + r % 121;
+    }
+    return 160 + r % 241;
+  }
+};
+
+static uint8_t onsetShift(uint32_t latency) {
+  uint8_t shift = ONSET_BUCKET_SHIFT;
+  while (((latency + 2000) >> shift) >= BUDGET_BUCKETS) {
+    shift++;
+  }
+  return shift;
+}
+
+static void replayOnsets(const Song& song, const RenderSettings& settings, RenderJob& job) {
+  uint32_t period = 1000000 / settings.rate;
+  uint8_t shift = onsetShift(settings.jitterLatency);
+  job.immediate.begin(period, shift);
+  job.scheduled.begin(settings.jitterLatency + SCHEDULE_AHEAD_US, shift);
+  job.late = 0;
+
+  // Immediate: dispatched in the pass that reads it, out with the next tick
+  LoopModel loop = { 0x2545F491u };
+  std::vector<uint32_t> waiting;
+  uint32_t now = 0;
+  uint32_t nextTick = period;
+  size_t next = 0;
+  while (next < song.events.size() || !waiting.empty()) {
+    uint32_t end = now + loop.pass();
+    while (next < song.events.size() && song.events[next].time <= now) {
+      if (song.events[next].status == EVENT_TYPE_NOTE_ON) {
+        waiting.push_back((uint32_t)song.events[next].time);
+      }
+      next++;
+    }
+    if ((int32_t)(end - nextTick) >= 0) {
+      for (size_t i = 0; i < waiting.size(); i++) {
+        job.immediate.record(end - waiting[i]);
+      }
+      waiting.clear();
+      while ((int32_t)(end - nextTick) >= 0) {
+        nextTick += period;
+      }
+    }
+    now = end;
+  }
+
+  // Scheduled: same passes, the firmware's batching, an exact commit timer
+  loop.state = 0x2545F491u;
+  OutputSchedule schedule;
+  schedule.begin(settings.jitterLatency);
+  std::vector<MidiEvent> queue;      // ingest order is time order here
+  std::vector<uint32_t> arrival;
+  std::vector<uint32_t> batch;
+  uint32_t commitAt = 0;
+  now = 0;
+  next = 0;
+  while (next < song.events.size() || !queue.empty() || schedule.staged) {
+    uint32_t end = now + loop.pass();
+    while (next < song.events.size() && song.events[next].time <= now) {
+      MidiEvent event;
+      event.time = now;
+      event.type = song.events[next].status;
+      queue.push_back(event);
+      arrival.push_back((uint32_t)song.events[next].time);
+      next++;
+    }
+    if (schedule.armed && (int32_t)(now - commitAt) >= 0) {
+      schedule.commit(commitAt);
+      for (size_t i = 0; i < batch.size(); i++) {
+        job.scheduled.record(commitAt - batch[i]);
+      }
+      batch.clear();
+    }
+    schedule.adopt();
+    size_t taken = 0;
+    while (taken < queue.size() && schedule.take(queue[taken], now)) {
+      if (queue[taken].type == EVENT_TYPE_NOTE_ON) {
+        batch.push_back(arrival[taken]);
+      }
+      taken++;
+    }
+    queue.erase(queue.begin(), queue.begin() + taken);
+    arrival.erase(arrival.begin(), arrival.begin() + taken);
+    if (schedule.staged && !schedule.armed) {
+      int32_t wait = schedule.arm(now);
+      commitAt = wait > 0 ? schedule.dueTime : now;
+    }
+    now = end;
+  }
+  job.late = schedule.late;
+}
+
+static void printOnsets(const char* name, const BudgetMonitor& onsets) {
+  uint32_t best = 0;
+  while (best < BUDGET_BUCKETS && onsets.histogram[best] == 0) {
+    best++;
+  }
+  printf("%-10s notes %8u  p50 %6u  p99 %6u  p99.9 %6u  worst %6u  spread %6u us\n", name, onsets.count,
+         onsets.percentile(500), onsets.percentile(990), onsets.percentile(999), onsets.worst,
+         onsets.worst - ((uint32_t)best << onsets.bucketShift));
+}
+
+static double cvFrequency(uint16_t volts) {
+  return TUNING_BASE_FREQUENCY + volts * (TUNING_TOP_FREQUENCY - TUNING_BASE_FREQUENCY) / 16383.0;
+}
+
+static void renderFile(RenderJob& job, const RenderSettings& settings) {
+  RenderStats& stats = job.stats;
+  memset(&stats, 0, sizeof(stats));
+  job.ok = false;
+
+  Song song;
+  if (!loadSong(job.path, settings.channel, song, job.error)) {
+    return;
+  }
+  uint64_t length = song.events.empty() ? 0 : song.events.back().time;
+  uint64_t ticks = (length + RENDER_TAIL_US) * settings.rate / 1000000 + 1;
+  if (ticks > 0xFFFFFFFFu) {
+    job.error = "too long";
+    return;
+  }
+  stats.ticks = (uint32_t)ticks;
+
+  size_t size = sizeof(CvFileHeader) + (size_t)ticks * NUM_VOICES * sizeof(CvSample);
+  int fd = open(job.outputPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    job.error = "cannot create " + job.outputPath;
+    return;
+  }
+  if (ftruncate(fd, size) != 0) {
+    close(fd);
+    job.error = "cannot size " + job.outputPath;
+    return;
+  }
+  void* map = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    job.error = "cannot map " + job.outputPath;
+    return;
+  }
+  CvFileHeader* header = (CvFileHeader*)map;
+  memcpy(header->magic, "DCO8CV\0\0", 8);
+  header->version = RENDER_VERSION;
+  header->voices = NUM_VOICES;
+  header->rate = settings.rate;
+  header->ticks = stats.ticks;
+  CvSample* sample = (CvSample*)(header + 1);
+
+  VoiceEngine engine;
+  engine.begin(&patch, &calibration, settings.tuning);
+  MidiClock clock;
+  clock.reset();
+  clock.start(0);
+
+  size_t nextEvent = 0;
+  size_t nextClock = 0;
+  for (uint32_t tick = 0; tick < stats.ticks; tick++) {
+    uint64_t now = (uint64_t)tick * 1000000 / settings.rate;
+    while (nextClock < song.clocks.size() && song.clocks[nextClock] <= now) {
+      clock.tick((uint32_t)song.clocks[nextClock++]);
+    }
+    while (nextEvent < song.events.size() && song.events[nextEvent].time <= now) {
+      const SongEvent& songEvent = song.events[nextEvent++];
+      MidiEvent event;
+      event.time = (uint32_t)songEvent.time;
+      event.source = EVENT_SOURCE_DIN;
+      event.type = songEvent.status;
+      event.channel = 1;
+      event.data1 = songEvent.data1;
+      event.data2 = songEvent.data2;
+      if (event.type == EVENT_TYPE_NOTE_ON) {
+        stats.notes++;
+      }
+      engine.handleEvent(event, (unsigned long)(songEvent.time / 1000));
+    }
+
+    engine.updateLfo(clock.phase((uint32_t)now));
+    engine.smoothPressure();
+    engine.glide();
+    engine.render();
+    double factor = engine.pitchFactor();
+
+    for (int i = 0; i < NUM_VOICES; i++, sample++) {
+      const Voice& voice = engine.voices[i];
+      sample->volts = voice.bentNoteVolts;
+      sample->frequency = voice.bentNoteFreq;
+      sample->note = voice.midiNote;
+      sample->flags = (voice.noteOn ? SAMPLE_NOTE_ON : 0) | (voice.keyDown ? SAMPLE_KEY_DOWN : 0) | (voice.sustained ? SAMPLE_SUSTAINED : 0);
+      sample->reserved = 0;
+      if (!voice.noteOn) {
+        continue;
+      }
+      stats.sounding++;
+      double target = settings.tuning->noteFrequency[voice.midiNote] * factor * (i == engine.monoVoice ? engine.glideFactor() : 1.0);
+      if (target < TUNING_BASE_FREQUENCY || target > TUNING_TOP_FREQUENCY) {
+        stats.outOfRange++;
+        continue;
+      }
+      double cents = 1200.0 * log2(cvFrequency(voice.bentNoteVolts) / target);
+      stats.sumCents += fabs(cents);
+      stats.sumSquares += cents * cents;
+      if (fabs(cents) > fabs(stats.worstCents)) {
+        stats.worstCents = cents;
+        stats.worstNote = voice.midiNote;
+        stats.worstTick = tick;
+      }
+    }
+  }
+  munmap(map, size);
+  if (settings.jitterLatency >= 0) {
+    replayOnsets(song, settings, job);
+  }
+  job.ok = true;
+}
+
+static void printStats(const char* name, const RenderStats& stats) {
+  uint64_t measured = stats.sounding - stats.outOfRange;
+  double mean = measured > 0 ? stats.sumCents / measured : 0;
+  double rms = measured > 0 ? sqrt(stats.sumSquares / measured) : 0;
+  printf("%-32s %8u %6u %10llu %9llu %7.3f %7.3f %8.3f (note %u, tick %u)\n", name, stats.ticks, stats.notes,
+         (unsigned long long)stats.sounding, (unsigned long long)stats.outOfRange, mean, rms, stats.worstCents,
+         stats.worstNote, stats.worstTick);
+}
+
+static bool readText(const char* path, char* buffer, size_t size) {
+  FILE* file = fopen(path, "rb");
+  if (file == 0) {
+    fprintf(stderr, "cannot open %s\n", path);
+    return false;
+  }
+  size_t length = fread(buffer, 1, size - 1, file);
+  buffer[length] = 0;
+  fclose(file);
+  return true;
+}
+
+int main(int argc, char** argv) {
+  unsigned threads = std::thread::hardware_concurrency();
+  const char* outputDir = ".";
+  const char* scalePath = 0;
+  const char* keyboardPath = 0;
+  double maxCents = -1;
+  RenderSettings settings = { RENDER_RATE_HZ, 0, 0, -1 };
+  std::vector<RenderJob> jobs;
+  for (int i = 1; i < argc; i++) {
+    bool hasValue = i + 1 < argc;
+    if (strcmp(argv[i], "-j") == 0 && hasValue) {
+      threads = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-o") == 0 && hasValue) {
+      outputDir = argv[++i];
+    } else if (strcmp(argv[i], "--rate") == 0 && hasValue) {
+      settings.rate = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--channel") == 0 && hasValue) {
+      settings.channel = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--scl") == 0 && hasValue) {
+      scalePath = argv[++i];
+    } else if (strcmp(argv[i], "--kbm") == 0 && hasValue) {
+      keyboardPath = argv[++i];
+    } else if (strcmp(argv[i], "--jitter") == 0 && hasValue) {
+      settings.jitterLatency = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--max-cents") == 0 && hasValue) {
+      maxCents = atof(argv[++i]);
+    } else {
+      RenderJob job;
+      job.path = argv[i];
+      jobs.push_back(job);
+    }
+  }
+  if (jobs.empty() || settings.rate == 0 || settings.channel < 0 || settings.channel > 16) {
+    fprintf(stderr, "usage: cv_render [-j threads] [-o dir] [--rate hz] [--channel n] [--scl scale.scl [--kbm map.kbm]] [--max-cents c] [--jitter us] file.mid...\n");
+    return 2;
+  }
+
+  patchDefaults();
+  calibrationDefaults();
+  static TuningTable table;
+  if (scalePath != 0) {
+    static char text[TUNING_TEXT_SIZE];
+    ScalaScale scale;
+    ScalaKeyboard keyboard;
+    if (!readText(scalePath, text, sizeof(text)) || !scalaParseScale(text, scale)) {
+      fprintf(stderr, "%s: not a valid Scala scale\n", scalePath);
+      return 2;
+    }
+    if (keyboardPath == 0) {
+      scalaDefaultKeyboard(keyboard);
+    } else if (!readText(keyboardPath, text, sizeof(text)) || !scalaParseKeyboard(text, keyboard)) {
+      fprintf(stderr, "%s: not a valid Scala keyboard mapping\n", keyboardPath);
+      return 2;
+    }
+    tuningBuild(scale, keyboard, table);
+  } else {
+    tuningEqual(table);
+  }
+  settings.tuning = &table;
+
+  for (size_t i = 0; i < jobs.size(); i++) {
+    std::string name = jobs[i].path;
+    size_t slash = name.find_last_of('/');
+    if (slash != std::string::npos) {
+      name = name.substr(slash + 1);
+    }
+    size_t dot = name.find_last_of('.');
+    if (dot != std::string::npos && dot > 0) {
+      name = name.substr(0, dot);
+    }
+    jobs[i].outputPath = std::string(outputDir) + "/" + name + ".cv";
+  }
+
+  // Every worker owns its engine; jobs are handed out one file at a time
+  if (threads == 0) {
+    threads = 1;
+  }
+  if (threads > jobs.size()) {
+    threads = jobs.size();
+  }
+  std::atomic<size_t> nextJob(0);
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < threads; t++) {
+    workers.push_back(std::thread([&]() {
+      for (size_t n = nextJob++; n < jobs.size(); n = nextJob++) {
+        renderFile(jobs[n], settings);
+      }
+    }));
+  }
+  for (size_t t = 0; t < workers.size(); t++) {
+    workers[t].join();
+  }
+
+  printf("%-32s %8s %6s %10s %9s %7s %7s %8s\n", "file", "ticks", "notes", "sounding", "range", "mean", "rms", "worst");
+  RenderStats total;
+  memset(&total, 0, sizeof(total));
+  int failures = 0;
+  for (size_t i = 0; i < jobs.size(); i++) {
+    const RenderStats& stats = jobs[i].stats;
+    if (!jobs[i].ok) {
+      printf("%-32s %s\n", jobs[i].path, jobs[i].error.c_str());
+      failures++;
+      continue;
+    }
+    printStats(jobs[i].outputPath.c_str() + strlen(outputDir) + 1, stats);
+    total.ticks += stats.ticks;
+    total.notes += stats.notes;
+    total.sounding += stats.sounding;
+    total.outOfRange += stats.outOfRange;
+    total.sumCents += stats.sumCents;
+    total.sumSquares += stats.sumSquares;
+    if (fabs(stats.worstCents) > fabs(total.worstCents)) {
+      total.worstCents = stats.worstCents;
+      total.worstNote = stats.worstNote;
+      total.worstTick = stats.worstTick;
+    }
+  }
+  printStats("total", total);
+
+  if (settings.jitterLatency >= 0) {
+    // Same bucket width in every job, so the histograms add up
+    BudgetMonitor immediate;
+    BudgetMonitor scheduled;
+    uint8_t shift = onsetShift(settings.jitterLatency);
+    immediate.begin(0, shift);
+    scheduled.begin(0, shift);
+    uint32_t late = 0;
+    for (size_t i = 0; i < jobs.size(); i++) {
+      if (!jobs[i].ok) {
+        continue;
+      }
+      for (int b = 0; b < BUDGET_BUCKETS; b++) {
+        immediate.histogram[b] += jobs[i].immediate.histogram[b];
+        scheduled.histogram[b] += jobs[i].scheduled.histogram[b];
+      }
+      immediate.count += jobs[i].immediate.count;
+      scheduled.count += jobs[i].scheduled.count;
+      immediate.worst = std::max(immediate.worst, jobs[i].immediate.worst);
+      scheduled.worst = std::max(scheduled.worst, jobs[i].scheduled.worst);
+      late += jobs[i].late;
+    }
+    printf("\nNote onset after the file time, %u us buckets\n", 1u << shift);
+    printOnsets("immediate", immediate);
+    printOnsets("scheduled", scheduled);
+    printf("scheduled batches armed late: %u\n\n", late);
+    printf("%13s %10s %10s\n", "us", "immediate", "scheduled");
+    for (int b = 0; b < BUDGET_BUCKETS; b++) {
+      if (immediate.histogram[b] != 0 || scheduled.histogram[b] != 0) {
+        printf("%6u-%-6u %10u %10u\n", (unsigned)b << shift, (unsigned)(b + 1) << shift, immediate.histogram[b], scheduled.histogram[b]);
+      }
+    }
+  }
+  if (maxCents >= 0 && fabs(total.worstCents) > maxCents) {
+    printf("worst error %.3f cents exceeds %.3f\n", total.worstCents, maxCents);
+    return 1;
+  }
+  return failures > 0 ? 1 : 0;
+}
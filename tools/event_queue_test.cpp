@@ -0,0 +1,258 @@
+// Host test for the merged input queue (src/EventQueue.cpp) with mock DIN and
+// USB sources, read and stamped the way ingestMidi() in src/main.cpp does.
+//
+//   g++ -std=c++14 -O2 -Iinclude tools/event_queue_test.cpp src/EventQueue.cpp -o event_queue_test
+//   ./event_queue_test [--seed n] [--seconds n] [--latency us]
+//
+// DIN: 3 byte messages back to back on the wire at MIDI_DIN_BYTE_US per
+// byte, in bursts (chords). USB: packets of 1-16 messages at random times.
+// Loop passes come every 20-300 µs with the odd 2 ms stall and make up to
+// INGEST_BURST reads per port each. A DIN read takes one byte off the mock
+// UART and only returns a message with its last byte, stopping the burst
+// otherwise, as the MIDI library's default one byte parsing does; the
+// message is stamped with dinArrival() from the bytes still buffered.
+// Events leave the queue once their time plus the output latency is due, as
+// the scheduled dispatch does (--latency 0: every pass, all of them).
+// Checks, exit status 1 on any failure:
+//   order      the events leaving in one pass do so in timestamp order, and
+//              each source's in the order they were sent
+//   stamps     no stamp before the message's true arrival or after the
+//              pass that read it
+// An event stamped before one that left in an earlier pass was read more
+// than the latency after it arrived; those are counted, not failed.
+// Prints the stamp error per source next to that of stamping at read time,
+// how many pushes sorted in ahead of the tail, overflows, and push + pop
+// throughput in ns per event.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include "EventQueue.h"
+
+#define TEST_SECONDS 10
+#define TEST_LATENCY_US 1500
+#define INGEST_BURST 16             // as src/main.cpp
+#define DIN_MESSAGE_BYTES 3
+#define THROUGHPUT_EVENTS 10000000
+
+typedef std::chrono::steady_clock Clock;
+
+struct MockMessage {
+  double arrival;              // µs the last byte (DIN) or the packet (USB) came in
+  uint32_t sequence;           // per source, in sending order
+};
+
+struct SourceStats {
+  uint32_t sent;
+  uint32_t received;
+  double stampErrorSum;
+  double stampErrorWorst;
+  double readErrorSum;         // stamped at read time instead
+  uint32_t stampWrong;
+};
+
+static uint32_t random32 = 0x2545F491;
+
+static uint32_t nextRandom() {
+  random32 ^= random32 << 13;
+  random32 ^= random32 >> 17;
+  random32 ^= random32 << 5;
+  return random32;
+}
+
+// DIN: bursts of 1-8 messages back to back, gaps of 1-50 ms between
+static std::vector<MockMessage> dinStream(double seconds) {
+  std::vector<MockMessage> messages;
+  double wire = 1000;
+  uint32_t sequence = 0;
+  while (wire < seconds * 1e6) {
+    int burst = 1 + nextRandom() % 8;
+    for (int i = 0; i < burst; i++) {
+      wire += DIN_MESSAGE_BYTES * MIDI_DIN_BYTE_US;
+      MockMessage message = { wire, sequence++ };
+      messages.push_back(message);
+    }
+    wire += 1000 + nextRandom() % 49000;
+  }
+  return messages;
+}
+
+// USB: packets of 1-16 messages, 0.1-20 ms apart
+static std::vector<MockMessage> usbStream(double seconds) {
+  std::vector<MockMessage> messages;
+  double at = 1500;
+  uint32_t sequence = 0;
+  while (at < seconds * 1e6) {
+    int packet = 1 + nextRandom() % 16;
+    for (int i = 0; i < packet; i++) {
+      MockMessage message = { at, sequence++ };
+      messages.push_back(message);
+    }
+    at += 100 + nextRandom() % 19900;
+  }
+  return messages;
+}
+
+// Byte n of the DIN stream, the last of each message at its arrival
+static double dinByteArrival(const std::vector<MockMessage>& stream, size_t n) {
+  return stream[n / DIN_MESSAGE_BYTES].arrival - (DIN_MESSAGE_BYTES - 1 - n % DIN_MESSAGE_BYTES) * MIDI_DIN_BYTE_US;
+}
+
+static MidiEvent makeEvent(uint32_t time, uint8_t source, uint32_t sequence) {
+  MidiEvent event;
+  event.time = time;
+  event.source = source;
+  event.type = EVENT_TYPE_NOTE_ON;
+  event.channel = 1;
+  // The sequence number rides in the data bytes
+  event.data1 = sequence & 0x7F;
+  event.data2 = (sequence >> 7) & 0x7F;
+  return event;
+}
+
+int main(int argc, char** argv) {
+  double seconds = TEST_SECONDS;
+  uint32_t latency = TEST_LATENCY_US;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      random32 = atoi(argv[++i]);
+      if (random32 == 0) {
+        random32 = 1;
+      }
+    } else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+      seconds = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--latency") == 0 && i + 1 < argc) {
+      latency = atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "usage: event_queue_test [--seed n] [--seconds n] [--latency us]\n");
+      return 2;
+    }
+  }
+
+  std::vector<MockMessage> streams[2] = { dinStream(seconds), usbStream(seconds) };
+  size_t next[2] = { 0, 0 };
+  SourceStats stats[2];
+  memset(stats, 0, sizeof(stats));
+  stats[0].sent = streams[0].size();
+  stats[1].sent = streams[1].size();
+
+  size_t dinBytesRead = 0;
+  size_t dinBytes = streams[EVENT_SOURCE_DIN].size() * DIN_MESSAGE_BYTES;
+
+  EventQueue queue;
+  queue.begin();
+  uint32_t expected[2] = { 0, 0 };
+  uint32_t lastTime = 0;
+  bool haveLast = false;
+  unsigned failures = 0;
+  uint32_t sortedIn = 0;
+  uint32_t behindLatency = 0;
+  double now = 0;
+  while (now < seconds * 1e6 + 100000) {
+    now += nextRandom() % 100 == 0 ? 2000 : 20 + nextRandom() % 280;
+    uint32_t micros = (uint32_t)now;
+
+    // ------------------ Ingest, DIN first like the task
+    for (int source = 0; source < 2; source++) {
+      std::vector<MockMessage>& stream = streams[source];
+      for (int n = 0; n < INGEST_BURST; n++) {
+        uint32_t time = micros;
+        if (source == EVENT_SOURCE_DIN) {
+          if (dinBytesRead == dinBytes || dinByteArrival(stream, dinBytesRead) > now) {
+            break;
+          }
+          if (++dinBytesRead % DIN_MESSAGE_BYTES != 0) {
+            break;
+          }
+          uint32_t bytesBehind = 0;
+          while (dinBytesRead + bytesBehind < dinBytes && dinByteArrival(stream, dinBytesRead + bytesBehind) <= now) {
+            bytesBehind++;
+          }
+          time = dinArrival(micros, bytesBehind);
+        } else if (next[source] == stream.size() || stream[next[source]].arrival > now) {
+          break;
+        }
+        const MockMessage& message = stream[next[source]++];
+        double error = (double)(int32_t)(time - (uint32_t)message.arrival);
+        SourceStats& s = stats[source];
+        s.stampErrorSum += error;
+        s.readErrorSum += now - message.arrival;
+        if (error > s.stampErrorWorst) {
+          s.stampErrorWorst = error;
+        }
+        // Whole µs on both sides, so one of rounding
+        if (error < -1 || (int32_t)(micros - time) < 0) {
+          s.stampWrong++;
+        }
+        if (queue.count && (int32_t)(queue.events[(queue.head + queue.count - 1) & (EVENT_QUEUE_SIZE - 1)].time - time) > 0) {
+          sortedIn++;
+        }
+        queue.push(makeEvent(time, source, message.sequence));
+      }
+    }
+
+    // ------------------ Dispatch what is due
+    bool batch = false;
+    while (!queue.empty() && (latency == 0 || (int32_t)(micros - (queue.front().time + latency)) >= 0)) {
+      const MidiEvent& event = queue.front();
+      uint32_t sequence = event.data1 | (uint32_t)event.data2 << 7;
+      if (haveLast && (int32_t)(event.time - lastTime) < 0) {
+        if (batch) {
+          printf("order: event at %u after one at %u\n", event.time, lastTime);
+          failures++;
+        } else {
+          behindLatency++;
+        }
+      }
+      batch = true;
+      if ((sequence & 0x3FFF) != (expected[event.source] & 0x3FFF)) {
+        printf("order: source %u sent %u, expected %u\n", event.source, sequence, expected[event.source] & 0x3FFF);
+        failures++;
+      }
+      expected[event.source]++;
+      stats[event.source].received++;
+      lastTime = event.time;
+      haveLast = true;
+      queue.pop(micros);
+    }
+  }
+
+  const char* names[2] = { "DIN", "USB" };
+  for (int source = 0; source < 2; source++) {
+    const SourceStats& s = stats[source];
+    uint32_t overflows = queue.sources[source].overflows;
+    uint32_t stamped = s.received + overflows;
+    printf("%s  sent %u  received %u  overflows %u  stamp error avg/worst us %.1f/%.1f (at read %.1f)  latency avg/max us %u/%u\n",
+           names[source], s.sent, s.received, overflows, stamped ? s.stampErrorSum / stamped : 0.0, s.stampErrorWorst,
+           stamped ? s.readErrorSum / stamped : 0.0, queue.averageLatency(source), queue.sources[source].latencyMax);
+    if (s.received + overflows != s.sent) {
+      printf("%s: %u events lost\n", names[source], s.sent - s.received - overflows);
+      failures++;
+    }
+    if (s.stampWrong) {
+      printf("%s: %u stamps before arrival or after the read\n", names[source], s.stampWrong);
+      failures++;
+    }
+  }
+  printf("sorted in ahead of the tail: %u  read later than the latency: %u\n", sortedIn, behindLatency);
+
+  // ------------------ Throughput, queue half full
+  queue.begin();
+  uint32_t time = 0;
+  for (int i = 0; i < EVENT_QUEUE_SIZE / 2; i++) {
+    queue.push(makeEvent(time++, EVENT_SOURCE_USB, 0));
+  }
+  Clock::time_point start = Clock::now();
+  for (uint32_t i = 0; i < THROUGHPUT_EVENTS; i++) {
+    // Every fourth one from the past, as a late DIN read
+    uint32_t stamp = (i & 3) == 0 ? time - 8 : time;
+    queue.push(makeEvent(stamp, i & 1, 0));
+    queue.pop(time);
+    time++;
+  }
+  double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / THROUGHPUT_EVENTS;
+  printf("push + pop: %.1f ns per event\n", ns);
+  return failures ? 1 : 0;
+}
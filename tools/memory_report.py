@@ -0,0 +1,244 @@
+# Memory placement report for the Teensy 4.1 build.
+#
+# As a PlatformIO post script (platformio.ini: extra_scripts) it adds a
+# linker map to the build and runs after every link. Standalone:
+#
+#   python3 tools/memory_report.py .pio/build/teensy41/firmware.elf [--map firmware.map] [--hot tools/hot_symbols.txt]
+#
+# Prints the size of every output section and the usage of each memory region
+# from the linker map, then looks up the symbols in tools/hot_symbols.txt in
+# the ELF's symbol table. A hot symbol found in another region (hot code
+# dropped out of ITCM, a hot table out of DTCM) is an error, exit status 1 and
+# a failed build. A listed symbol that is not in the ELF only warns.
+
+import os
+import re
+import subprocess
+import sys
+
+# ----------------------------- Regions (imxrt1062_t41.ld)
+# ITCM and DTCM share the 512K of RAM1, handed out in 32K FlexRAM banks
+REGIONS = [
+    ("ITCM", 0x00000000, 512 * 1024),
+    ("DTCM", 0x20000000, 512 * 1024),
+    ("RAM", 0x20200000, 512 * 1024),
+    ("FLASH", 0x60000000, 7936 * 1024),
+    ("ERAM", 0x70000000, 16384 * 1024),
+]
+RAM1_SIZE = 512 * 1024
+FLEXRAM_BANK = 32 * 1024
+
+# Not loaded, but linked at address 0 like ITCM
+NOT_ALLOCATED = (".debug", ".comment", ".ARM.attributes", ".stab", ".gnu.")
+
+
+def region_of(address, regions):
+    for name, origin, length in regions:
+        if origin <= address < origin + length:
+            return name
+    return None
+
+
+# ----------------------------- Linker map
+def parse_map(path):
+    """Returns (regions, sections): the map's Memory Configuration and a list
+    of (name, address, size, load address) for every allocated output
+    section."""
+    regions = []
+    sections = []
+    with open(path) as f:
+        lines = f.read().splitlines()
+
+    in_memory = False
+    in_layout = False
+    pending = None
+    for line in lines:
+        if line.startswith("Memory Configuration"):
+            in_memory = True
+            continue
+        if line.startswith("Linker script and memory map"):
+            in_memory = False
+            in_layout = True
+            continue
+        if in_memory:
+            fields = line.split()
+            if len(fields) >= 3 and fields[1].startswith("0x") and fields[0] != "*default*":
+                regions.append((fields[0], int(fields[1], 16), int(fields[2], 16)))
+            continue
+        if not in_layout:
+            continue
+
+        # Output sections start in column 0; a long name wraps and puts the
+        # address and size on the next line
+        if pending is not None:
+            line = pending + " " + line.strip()
+            pending = None
+        elif not line.startswith("."):
+            continue
+        fields = line.split()
+        if len(fields) == 1:
+            pending = fields[0]
+            continue
+        if len(fields) < 3 or not fields[1].startswith("0x"):
+            continue
+        name = fields[0]
+        if name.startswith(NOT_ALLOCATED):
+            continue
+        load = None
+        match = re.search(r"load address (0x[0-9a-fA-F]+)", line)
+        if match:
+            load = int(match.group(1), 16)
+        sections.append((name, int(fields[1], 16), int(fields[2], 16), load))
+    return regions or REGIONS, sections
+
+
+def region_usage(regions, sections):
+    used = dict((name, 0) for name, _, _ in regions)
+    for name, address, size, load in sections:
+        region = region_of(address, regions)
+        if region is not None:
+            used[region] += size
+        # Initialized RAM sections (.data, .text.itcm) also take their image
+        # in flash
+        if load is not None and load != address:
+            image = region_of(load, regions)
+            if image is not None and image != region:
+                used[image] += size
+    return used
+
+
+# ----------------------------- Symbols
+def tool(env, name):
+    """The toolchain's binutils if there are any, the host's otherwise."""
+    candidates = ["arm-none-eabi-" + name, name]
+    path = os.environ.get("PATH", "")
+    if env is not None:
+        path = env["ENV"].get("PATH", path)
+    for candidate in candidates:
+        for directory in path.split(os.pathsep):
+            if os.path.isfile(os.path.join(directory, candidate)):
+                return os.path.join(directory, candidate)
+    return None
+
+
+def read_symbols(elf, nm):
+    """Maps demangled name, without argument list, to (address, size)."""
+    output = subprocess.check_output([nm, "-C", "-S", "--defined-only", elf])
+    symbols = {}
+    for line in output.decode("utf-8", "replace").splitlines():
+        match = re.match(r"([0-9a-fA-F]+)\s+(?:([0-9a-fA-F]+)\s+)?(\w)\s+(.+)$", line)
+        if match is None:
+            continue
+        address = int(match.group(1), 16)
+        size = int(match.group(2), 16) if match.group(2) else 0
+        name = match.group(4)
+        # "void ingestMidi<usb_serial_class>(usb_serial_class&, unsigned char)",
+        # "VoiceEngineT<(unsigned char)8>::noteOn(...)": template arguments
+        # go, innermost first, so a hot list entry covers every instance
+        base = name
+        while True:
+            stripped = re.sub(r"<[^<>]*>", "", base)
+            if stripped == base:
+                break
+            base = stripped
+        base = re.sub(r"\(.*\)( const)?$", "", base).split()[-1]
+        symbols.setdefault(base, []).append((address, size))
+    return symbols
+
+
+def read_hot_list(path):
+    hot = []
+    with open(path) as f:
+        for number, line in enumerate(f, 1):
+            line = line.split("#", 1)[0].strip()
+            if not line:
+                continue
+            fields = line.split(None, 1)
+            if len(fields) != 2:
+                raise ValueError("%s:%d: expected '<region> <symbol>'" % (path, number))
+            hot.append((fields[0], fields[1].strip()))
+    return hot
+
+
+# ----------------------------- Report
+def report(elf, map_path, hot_path, env=None):
+    regions, sections = parse_map(map_path)
+    used = region_usage(regions, sections)
+
+    print("Memory placement (%s)" % os.path.basename(elf))
+    for name, address, size, load in sections:
+        if size:
+            print("  %-20s 0x%08x %8d  %s" % (name, address, size, region_of(address, regions) or "-"))
+    for name, origin, length in regions:
+        print("  %-6s %8d of %8d bytes (%5.1f%%)" % (name, used[name], length, 100.0 * used[name] / length))
+    if "ITCM" in used and "DTCM" in used:
+        itcm = (used["ITCM"] + FLEXRAM_BANK - 1) // FLEXRAM_BANK * FLEXRAM_BANK
+        print("  RAM1   %d bytes ITCM (%d banks), %d bytes left for DTCM and stack"
+              % (itcm, itcm // FLEXRAM_BANK, RAM1_SIZE - itcm - used["DTCM"]))
+
+    nm = tool(env, "nm")
+    if nm is None:
+        print("memory_report: no nm found, hot symbols not checked")
+        return 0
+    symbols = read_symbols(elf, nm)
+    errors = 0
+    for expected, name in read_hot_list(hot_path):
+        if name not in symbols:
+            print("  warning: %s not found (inlined or not built)" % name)
+            continue
+        for address, size in symbols[name]:
+            actual = region_of(address, regions)
+            if actual != expected:
+                print("  error: %s is in %s at 0x%08x, expected %s" % (name, actual, address, expected))
+                errors += 1
+    if errors:
+        print("memory_report: %d hot symbol(s) out of place" % errors)
+        return 1
+    print("  hot symbols in place")
+    return 0
+
+
+def main(argv):
+    elf = None
+    map_path = None
+    hot_path = os.path.join(os.path.dirname(os.path.abspath(__file__)), "hot_symbols.txt")
+    i = 1
+    while i < len(argv):
+        if argv[i] == "--map" and i + 1 < len(argv):
+            map_path = argv[i + 1]
+            i += 1
+        elif argv[i] == "--hot" and i + 1 < len(argv):
+            hot_path = argv[i + 1]
+            i += 1
+        elif elf is None:
+            elf = argv[i]
+        else:
+            print("usage: memory_report.py firmware.elf [--map firmware.map] [--hot hot_symbols.txt]")
+            return 2
+        i += 1
+    if elf is None:
+        print("usage: memory_report.py firmware.elf [--map firmware.map] [--hot hot_symbols.txt]")
+        return 2
+    if map_path is None:
+        map_path = os.path.splitext(elf)[0] + ".map"
+    return report(elf, map_path, hot_path)
+
+
+# ----------------------------- PlatformIO hook
+try:
+    Import("env")  # noqa: F821, only defined inside SCons
+except NameError:
+    env = None
+
+if env is not None:
+    MAP = "$BUILD_DIR/${PROGNAME}.map"
+    HOT = os.path.join(env.subst("$PROJECT_DIR"), "tools", "hot_symbols.txt")
+    env.Append(LINKFLAGS=["-Wl,-Map," + MAP])
+
+    def after_link(source, target, env):
+        elf = env.subst("$BUILD_DIR/${PROGNAME}.elf")
+        return report(elf, env.subst(MAP), HOT, env)
+
+    env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", after_link)
+elif __name__ == "__main__":
+    sys.exit(main(sys.argv))
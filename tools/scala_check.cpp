@@ -0,0 +1,145 @@
+// Host check for tuning tables built from Scala files, using the firmware's
+// own parser and table builder (src/Tuning.cpp).
+//
+//   g++ -std=c++14 -O2 -Iinclude tools/scala_check.cpp src/Tuning.cpp src/SysEx.cpp -o scala_check
+//   ./scala_check scale.scl [keyboard.kbm] [--ref cents.txt] [--syx out.syx]
+//
+// Prints slot, MIDI key, frequency, CV code and cents relative to the
+// keyboard's reference pitch for every retuned slot.
+// --ref  lines of "<midi key> <cents>", cents relative to the reference
+//        frequency. Every listed key must match within 0.01 cents and its CV
+//        code within one step. Exit status 1 on any mismatch.
+// --syx  writes the SysEx messages that load this scale into the synth
+//        (block SYSEX_BLOCK_SCALA), ready for any SysEx librarian.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "SysEx.h"
+#include "Tuning.h"
+
+static char scalaText[TUNING_TEXT_SIZE];
+
+static void scalaTextDefaults() {
+  memset(scalaText, 0, sizeof(scalaText));
+}
+
+static bool readFile(const char* path, char* buffer, size_t size, size_t& length) {
+  FILE* file = fopen(path, "rb");
+  if (file == 0) {
+    fprintf(stderr, "cannot open %s\n", path);
+    return false;
+  }
+  length = fread(buffer, 1, size - 1, file);
+  buffer[length] = 0;
+  bool complete = feof(file) || fgetc(file) == EOF;
+  fclose(file);
+  if (!complete) {
+    fprintf(stderr, "%s does not fit into %u bytes\n", path, (unsigned)size);
+  }
+  return complete;
+}
+
+int main(int argc, char** argv) {
+  const char* scalePath = 0;
+  const char* keyboardPath = 0;
+  const char* referencePath = 0;
+  const char* sysexPath = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--ref") == 0 && i + 1 < argc) {
+      referencePath = argv[++i];
+    } else if (strcmp(argv[i], "--syx") == 0 && i + 1 < argc) {
+      sysexPath = argv[++i];
+    } else if (scalePath == 0) {
+      scalePath = argv[i];
+    } else {
+      keyboardPath = argv[i];
+    }
+  }
+  if (scalePath == 0) {
+    fprintf(stderr, "usage: scala_check scale.scl [keyboard.kbm] [--ref cents.txt] [--syx out.syx]\n");
+    return 2;
+  }
+
+  // Same layout the firmware expects in the SysEx text block
+  size_t scaleLength;
+  size_t keyboardLength = 0;
+  if (!readFile(scalePath, scalaText, sizeof(scalaText), scaleLength)) {
+    return 2;
+  }
+  if (keyboardPath != 0 && !readFile(keyboardPath, scalaText + scaleLength + 1, sizeof(scalaText) - scaleLength - 1, keyboardLength)) {
+    return 2;
+  }
+
+  ScalaScale scale;
+  ScalaKeyboard keyboard;
+  if (!scalaParseScale(scalaText, scale)) {
+    fprintf(stderr, "%s: not a valid Scala scale\n", scalePath);
+    return 1;
+  }
+  if (keyboardPath == 0) {
+    scalaDefaultKeyboard(keyboard);
+  } else if (!scalaParseKeyboard(scalaText + scaleLength + 1, keyboard)) {
+    fprintf(stderr, "%s: not a valid Scala keyboard mapping\n", keyboardPath);
+    return 1;
+  }
+
+  static TuningTable table;
+  tuningBuild(scale, keyboard, table);
+
+  printf("slot key  frequency    cv    cents\n");
+  for (int n = 0; n < TUNING_NOTES && n + TUNING_KEY_OFFSET <= 127; n++) {
+    double cents = 1200.0 * log2(table.noteFrequency[n] / keyboard.referenceFrequency);
+    printf("%4d %3d %10.4f %5u %8.3f\n", n, n + TUNING_KEY_OFFSET, table.noteFrequency[n], table.noteVolt[n], cents);
+  }
+
+  int failures = 0;
+  if (referencePath != 0) {
+    FILE* file = fopen(referencePath, "r");
+    if (file == 0) {
+      fprintf(stderr, "cannot open %s\n", referencePath);
+      return 2;
+    }
+    int key;
+    double expected;
+    int checked = 0;
+    while (fscanf(file, "%d %lf", &key, &expected) == 2) {
+      int slot = key - TUNING_KEY_OFFSET;
+      if (slot < 0 || slot >= TUNING_NOTES) {
+        fprintf(stderr, "key %d has no slot\n", key);
+        failures++;
+        continue;
+      }
+      double expectedFrequency = keyboard.referenceFrequency * pow(2.0, expected / 1200.0);
+      double cents = 1200.0 * log2(table.noteFrequency[slot] / keyboard.referenceFrequency);
+      int cvError = (int)table.noteVolt[slot] - (int)tuningVolts(expectedFrequency);
+      if (fabs(cents - expected) > 0.01 || cvError > 1 || cvError < -1) {
+        printf("MISMATCH key %d: %.3f cents (expected %.3f), cv %u (expected %u)\n", key, cents, expected, table.noteVolt[slot], tuningVolts(expectedFrequency));
+        failures++;
+      }
+      checked++;
+    }
+    fclose(file);
+    printf("%d keys checked, %d mismatches\n", checked, failures);
+  }
+
+  if (sysexPath != 0) {
+    const SysExBlock block = { SYSEX_BLOCK_SCALA, (uint8_t*)scalaText, sizeof(scalaText), scalaTextDefaults, 0 };
+    SysExStream stream;
+    stream.begin(&block, 1);
+    stream.requestDump(SYSEX_BLOCK_SCALA);
+    FILE* file = fopen(sysexPath, "wb");
+    if (file == 0) {
+      fprintf(stderr, "cannot write %s\n", sysexPath);
+      return 2;
+    }
+    uint8_t message[SYSEX_MAX_MESSAGE];
+    unsigned length;
+    while ((length = stream.nextMessage(message)) > 0) {
+      fwrite(message, 1, length, file);
+    }
+    fclose(file);
+  }
+  return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,263 @@
+// Host round-trip test for the SysEx bulk dump (src/SysEx.cpp): every data
+// block of the firmware dumped by one SysExStream and loaded by another,
+// message by message as nextMessage() builds them, into the firmware's own
+// structs with their own defaults.
+//
+//   g++ -std=c++14 -O2 -Iinclude tools/sysex_roundtrip.cpp src/SysEx.cpp src/Settings.cpp src/Player.cpp src/MidiClock.cpp -o sysex_roundtrip
+//   ./sysex_roundtrip [--seed n] [--rounds n]
+//
+// Per round every block is filled with random bytes and checked for:
+//   single     dump of the block alone loads byte for byte, loaded() runs
+//   all        a dump of all blocks (request 7F) loads them all
+//   request    a request message fed to receive() starts the same dump
+//   corrupt    one flipped bit in a chunk puts the block back to defaults
+//   gap        a chunk left out puts the block back to defaults
+//   aborted    a transfer cut short and followed by a new one: the first
+//              goes back to defaults, the second loads
+//   end        a wrong block checksum in the end message restores defaults
+//   validate   patchValidate() puts a random patch in range and leaves an
+//              in-range one as it is
+// Prints one line per check and block that fails; exit status 1 if any did.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "Player.h"
+#include "Schedule.h"
+#include "Settings.h"
+#include "SysEx.h"
+#include "Tuning.h"
+
+#define ROUNDTRIP_ROUNDS 100
+
+typedef std::vector<uint8_t> Message;
+
+// Receiving side: the firmware's globals, as in src/main.cpp
+static char scalaText[TUNING_TEXT_SIZE];
+static unsigned loadedCount;
+
+static void scalaTextDefaults() {
+  memset(scalaText, 0, sizeof(scalaText));
+}
+
+static void blockLoaded() {
+  loadedCount++;
+}
+
+static const SysExBlock receiveBlocks[] = {
+  { SYSEX_BLOCK_PATCH, (uint8_t*)&patch, sizeof(Patch), patchDefaults, blockLoaded },
+  { SYSEX_BLOCK_CALIBRATION, (uint8_t*)&calibration, sizeof(Calibration), calibrationDefaults, blockLoaded },
+  { SYSEX_BLOCK_SCALA, (uint8_t*)scalaText, sizeof(scalaText), scalaTextDefaults, blockLoaded },
+  { SYSEX_BLOCK_SEQUENCE, (uint8_t*)&sequence, sizeof(Sequence), sequenceDefaults, blockLoaded },
+};
+#define NUM_BLOCKS (sizeof(receiveBlocks) / sizeof(receiveBlocks[0]))
+
+// Sending side: same sizes, separate memory
+static Patch sentPatch;
+static Calibration sentCalibration;
+static char sentScalaText[TUNING_TEXT_SIZE];
+static Sequence sentSequence;
+
+static void noDefaults() {
+}
+
+static const SysExBlock sendBlocks[NUM_BLOCKS] = {
+  { SYSEX_BLOCK_PATCH, (uint8_t*)&sentPatch, sizeof(Patch), noDefaults, 0 },
+  { SYSEX_BLOCK_CALIBRATION, (uint8_t*)&sentCalibration, sizeof(Calibration), noDefaults, 0 },
+  { SYSEX_BLOCK_SCALA, (uint8_t*)sentScalaText, sizeof(sentScalaText), noDefaults, 0 },
+  { SYSEX_BLOCK_SEQUENCE, (uint8_t*)&sentSequence, sizeof(Sequence), noDefaults, 0 },
+};
+
+static uint32_t random32 = 0x2545F491;
+static unsigned failures;
+
+static uint32_t nextRandom() {
+  random32 ^= random32 << 13;
+  random32 ^= random32 >> 17;
+  random32 ^= random32 << 5;
+  return random32;
+}
+
+static std::vector<Message> dump(SysExStream& sender, uint8_t blockId) {
+  std::vector<Message> messages;
+  uint8_t out[SYSEX_MAX_MESSAGE];
+  sender.requestDump(blockId);
+  while (sender.txPending()) {
+    unsigned length = sender.nextMessage(out);
+    if (length > SYSEX_MAX_MESSAGE) {
+      fprintf(stderr, "message of %u bytes, more than SYSEX_MAX_MESSAGE\n", length);
+      exit(1);
+    }
+    messages.push_back(Message(out, out + length));
+  }
+  return messages;
+}
+
+static void feed(SysExStream& receiver, const std::vector<Message>& messages) {
+  for (size_t i = 0; i < messages.size(); i++) {
+    receiver.receive(messages[i].data(), messages[i].size());
+  }
+}
+
+static void check(bool ok, const char* name, const SysExBlock& block) {
+  if (!ok) {
+    printf("%-8s block %u failed\n", name, block.id);
+    failures++;
+  }
+}
+
+// Receiving block equals the sent one, or its defaults
+static bool matchesSent(int i) {
+  return memcmp(receiveBlocks[i].data, sendBlocks[i].data, receiveBlocks[i].size) == 0;
+}
+
+static bool matchesDefaults(int i, const std::vector<uint8_t>& defaults) {
+  return memcmp(receiveBlocks[i].data, defaults.data(), receiveBlocks[i].size) == 0;
+}
+
+static void scramble(int i) {
+  for (int k = 0; k < receiveBlocks[i].size; k++) {
+    receiveBlocks[i].data[k] = (uint8_t)nextRandom();
+  }
+}
+
+static void round(SysExStream& sender, SysExStream& receiver, const std::vector<uint8_t>* defaults) {
+  for (unsigned i = 0; i < NUM_BLOCKS; i++) {
+    for (int k = 0; k < sendBlocks[i].size; k++) {
+      sendBlocks[i].data[k] = (uint8_t)nextRandom();
+    }
+  }
+
+  for (unsigned i = 0; i < NUM_BLOCKS; i++) {
+    const SysExBlock& block = receiveBlocks[i];
+    std::vector<Message> messages = dump(sender, block.id);
+
+    // ------------------ Whole block
+    scramble(i);
+    unsigned loaded = loadedCount;
+    uint16_t errors = receiver.rxErrors;
+    feed(receiver, messages);
+    check(matchesSent(i) && loadedCount == loaded + 1 && receiver.rxErrors == errors, "single", block);
+
+    // ------------------ Request through receive()
+    uint8_t request[6] = { 0xF0, SYSEX_MANUFACTURER, SYSEX_DEVICE, SYSEX_CMD_REQUEST, block.id, 0xF7 };
+    SysExStream requested;
+    requested.begin(sendBlocks, NUM_BLOCKS);
+    requested.receive(request, sizeof(request));
+    scramble(i);
+    std::vector<Message> answer;
+    uint8_t out[SYSEX_MAX_MESSAGE];
+    while (requested.txPending()) {
+      unsigned length = requested.nextMessage(out);
+      answer.push_back(Message(out, out + length));
+    }
+    feed(receiver, answer);
+    check(answer.size() == messages.size() && matchesSent(i), "request", block);
+
+    // ------------------ One bit flipped in a random chunk's data
+    size_t chunks = messages.size() - 1;
+    std::vector<Message> corrupt = messages;
+    Message& chunk = corrupt[nextRandom() % chunks];
+    chunk[7 + nextRandom() % (chunk.size() - 9)] ^= 1 << (nextRandom() % 7);
+    scramble(i);
+    loaded = loadedCount;
+    errors = receiver.rxErrors;
+    feed(receiver, corrupt);
+    check(matchesDefaults(i, defaults[i]) && loadedCount == loaded && receiver.rxErrors > errors, "corrupt", block);
+
+    // ------------------ A chunk left out
+    if (chunks > 1) {
+      std::vector<Message> gap = messages;
+      gap.erase(gap.begin() + 1 + nextRandom() % (chunks - 1));
+      scramble(i);
+      loaded = loadedCount;
+      feed(receiver, gap);
+      check(matchesDefaults(i, defaults[i]) && loadedCount == loaded, "gap", block);
+    }
+
+    // ------------------ Cut short, then a new transfer
+    std::vector<Message> aborted(messages.begin(), messages.begin() + 1 + nextRandom() % chunks);
+    scramble(i);
+    loaded = loadedCount;
+    errors = receiver.rxErrors;
+    feed(receiver, aborted);
+    // The new first chunk aborts the old transfer, past it the defaults show
+    feed(receiver, std::vector<Message>(messages.begin(), messages.begin() + 1));
+    bool restored = memcmp(block.data + SYSEX_CHUNK_BYTES, defaults[i].data() + SYSEX_CHUNK_BYTES,
+                           block.size > SYSEX_CHUNK_BYTES ? block.size - SYSEX_CHUNK_BYTES : 0) == 0;
+    feed(receiver, std::vector<Message>(messages.begin() + 1, messages.end()));
+    check(restored && matchesSent(i) && loadedCount == loaded + 1 && receiver.rxErrors == errors + 1, "aborted", block);
+
+    // ------------------ Wrong block checksum
+    std::vector<Message> badEnd = messages;
+    Message& end = badEnd.back();
+    end[end.size() - 2] = (end[end.size() - 2] + 1) & 0x7F;
+    scramble(i);
+    loaded = loadedCount;
+    feed(receiver, badEnd);
+    check(matchesDefaults(i, defaults[i]) && loadedCount == loaded, "end", block);
+  }
+
+  // ------------------ All blocks in one dump
+  for (unsigned i = 0; i < NUM_BLOCKS; i++) {
+    scramble(i);
+  }
+  unsigned loaded = loadedCount;
+  feed(receiver, dump(sender, SYSEX_ALL_BLOCKS));
+  for (unsigned i = 0; i < NUM_BLOCKS; i++) {
+    check(matchesSent(i), "all", receiveBlocks[i]);
+  }
+  check(loadedCount == loaded + NUM_BLOCKS, "all", receiveBlocks[0]);
+
+  // ------------------ Patch validation, on the random patch just loaded
+  patchValidate();
+  bool inRange = patch.playMode <= PLAY_MODE_SEQUENCE && patch.arpPattern <= ARP_AS_PLAYED
+      && patch.keyMode <= KEY_MODE_LEGATO && patch.keyPriority <= KEY_PRIORITY_HIGH
+      && patch.arpOctaves >= 1 && patch.arpOctaves <= 4
+      && patch.stepsPerBeat >= 1 && patch.stepsPerBeat <= STEPS_PER_BEAT_MAX
+      && patch.gateLength >= 1 && patch.gateLength <= 8
+      && patch.outputLatency <= SCHEDULE_MAX_LATENCY_US
+      && patch.internalTempo >= INTERNAL_TEMPO_MIN && patch.internalTempo <= INTERNAL_TEMPO_MAX;
+  Patch valid = patch;
+  patchValidate();
+  bool kept = memcmp(&valid, &patch, sizeof(Patch)) == 0;
+  patchDefaults();
+  valid = patch;
+  patchValidate();
+  check(inRange && kept && memcmp(&valid, &patch, sizeof(Patch)) == 0, "validate", receiveBlocks[0]);
+}
+
+int main(int argc, char** argv) {
+  unsigned rounds = ROUNDTRIP_ROUNDS;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      random32 = atoi(argv[++i]);
+      if (random32 == 0) {
+        random32 = 1;
+      }
+    } else if (strcmp(argv[i], "--rounds") == 0 && i + 1 < argc) {
+      rounds = atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "usage: sysex_roundtrip [--seed n] [--rounds n]\n");
+      return 2;
+    }
+  }
+
+  // What a failed load must leave behind
+  std::vector<uint8_t> defaults[NUM_BLOCKS];
+  for (unsigned i = 0; i < NUM_BLOCKS; i++) {
+    receiveBlocks[i].defaults();
+    defaults[i].assign(receiveBlocks[i].data, receiveBlocks[i].data + receiveBlocks[i].size);
+  }
+
+  SysExStream sender;
+  SysExStream receiver;
+  sender.begin(sendBlocks, NUM_BLOCKS);
+  receiver.begin(receiveBlocks, NUM_BLOCKS);
+  for (unsigned r = 0; r < rounds; r++) {
+    round(sender, receiver, defaults);
+  }
+  printf("%u rounds, %u blocks, %u failed checks, %u rx errors\n", rounds, (unsigned)NUM_BLOCKS, failures, receiver.rxErrors);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,329 @@
+// Host monitor for the firmware's binary telemetry (include/Telemetry.h),
+// live from the USB serial port or from a capture file.
+//
+//   g++ -std=c++14 -O2 -Iinclude tools/telemetry_monitor.cpp src/Telemetry.cpp src/Tasks.cpp src/Trace.cpp -o telemetry_monitor
+//   ./telemetry_monitor /dev/ttyACM0 [--capture out.bin] [--voices n]
+//   ./telemetry_monitor out.bin
+//
+// A character device is put into raw mode and read until interrupted; with
+// --capture every byte read is also appended to a file that can be decoded
+// again later. Prints one line per frame:
+//   voices     note, flags (O on, K key down, S sustained, G gate), CV code,
+//              AD9833 word and pressure of every voice; only every n-th
+//              snapshot with --voices n
+//   counters   name=value, with the increase since the last counters frame
+//   histogram  count, p50/p99/p99.9 and worst in the histogram's units
+//   tasks      per loop task: calls, share that found work, average and
+//              worst cycles, background runs deferred
+//   trace      one line per entry: event, work flags, count and cycles, and
+//              how many entries were logged but never reached the host
+// Frames that fail the CRC and gaps in the sequence numbers are counted and
+// reported at the end.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+#include "Telemetry.h"
+
+static const char* counterNames[TELEMETRY_COUNTERS_COUNT] = {
+  "din", "usb", "overflows", "i2c", "i2cFailed", "i2cDropped", "i2cBusy",
+  "gateWrites", "gateEarly", "late", "degrade", "telemetryDropped", "idle",
+  "voicesReady", "firstNoteUs", "cvRate", "cvNoise", "voicesAbsent", "panelReads",
+  "i2cWaitCv", "i2cWaitGate", "i2cWaitPanel", "i2cWaitMaxCv", "i2cWaitMaxGate", "i2cWaitMaxPanel", "cvWritesFailed",
+  "dmaFrames", "dmaSkipped", "dmaLastNs", "dmaWorstNs",
+  "dinFiltered", "usbFiltered", "panelFiltered", "dinLatency", "usbLatency", "panelLatency",
+  "dinLatencyMax", "usbLatencyMax", "panelLatencyMax", "muxSelects", "muxSkipped",
+  "outputLatency", "onsetBest", "gateFailed", "gateRetriggers", "idleMs",
+  "listeningUs", "firstVoiceUs", "allVoicesUs", "notesMasked", "cvValue", "cvLowest", "cvHighest"
+};
+
+static const char* histogramNames[TELEMETRY_HISTOGRAMS] = {
+  "loop cycles", "tick cycles", "onset us", "gate skew us", "wake us"
+};
+
+static const char* traceNames[] = { "?", "loop overrun", "tick overrun", "degrade" };
+#define TRACE_NAMES (sizeof(traceNames) / sizeof(traceNames[0]))
+
+// Order of the task table in src/main.cpp
+static const char* taskNames[] = {
+  "ingest", "dispatch", "analog", "tick", "panel", "startup", "tuning", "sysex", "telemetry", "busStats"
+};
+#define TASK_NAMES (sizeof(taskNames) / sizeof(taskNames[0]))
+
+struct Monitor {
+  unsigned voiceEvery;
+  unsigned voiceFrames;
+  uint32_t lastCounters[TELEMETRY_COUNTERS_COUNT];
+  bool haveCounters;
+  uint32_t traceTotal;             // entries logged up to the last TRACE frame
+  bool haveSequence;
+  uint8_t nextSequence;
+  unsigned frames;
+  unsigned broken;
+  unsigned missing;
+};
+
+static uint16_t get16(const uint8_t* p) {
+  return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t* p) {
+  return (uint32_t)get16(p) | (uint32_t)get16(p + 2) << 16;
+}
+
+// ------------------------ Frame printers
+static void printVoices(Monitor& monitor, uint32_t time, const uint8_t* p, uint16_t length) {
+  if (length < 1 || length < 1 + p[0] * 9) {
+    monitor.broken++;
+    return;
+  }
+  if (monitor.voiceFrames++ % monitor.voiceEvery != 0) {
+    return;
+  }
+  printf("%10u voices", time);
+  for (int i = 0; i < p[0]; i++) {
+    const uint8_t* v = p + 1 + i * 9;
+    uint8_t flags = v[1];
+    printf("  %3u %c%c%c%c %5u %08x %3u", v[0],
+           flags & TELEMETRY_VOICE_FLAG_ON ? 'O' : '.',
+           flags & TELEMETRY_VOICE_FLAG_KEY_DOWN ? 'K' : '.',
+           flags & TELEMETRY_VOICE_FLAG_SUSTAINED ? 'S' : '.',
+           flags & TELEMETRY_VOICE_FLAG_GATE ? 'G' : '.',
+           get16(v + 2), get32(v + 4), v[8]);
+  }
+  printf("\n");
+}
+
+static void printCounters(Monitor& monitor, uint32_t time, const uint8_t* p, uint16_t length) {
+  if (length < 1 || length < 1 + p[0] * 4) {
+    monitor.broken++;
+    return;
+  }
+  printf("%10u counters", time);
+  for (int i = 0; i < p[0]; i++) {
+    uint32_t value = get32(p + 1 + i * 4);
+    if (i < TELEMETRY_COUNTERS_COUNT) {
+      printf("  %s=%u", counterNames[i], value);
+      if (monitor.haveCounters && value != monitor.lastCounters[i]) {
+        printf("(%+d)", (int32_t)(value - monitor.lastCounters[i]));
+      }
+      monitor.lastCounters[i] = value;
+    } else {
+      printf("  #%d=%u", i, value);
+    }
+  }
+  monitor.haveCounters = true;
+  printf("\n");
+}
+
+static void printHistogram(Monitor& monitor, uint32_t time, const uint8_t* p, uint16_t length) {
+  if (length < 16 || length < 16 + p[15] * 4) {
+    monitor.broken++;
+    return;
+  }
+  uint8_t id = p[0];
+  uint8_t shift = p[1];
+  uint32_t count = get32(p + 2);
+  uint32_t worst = get32(p + 6);
+  uint32_t overruns = get32(p + 10);
+  uint8_t first = p[14];
+  uint8_t buckets = p[15];
+  // Upper bucket edge of each share, as BudgetMonitor::percentile()
+  const uint16_t permille[3] = { 500, 990, 999 };
+  uint32_t edges[3] = { worst, worst, worst };
+  for (int k = 0; k < 3; k++) {
+    uint32_t target = (uint32_t)((uint64_t)count * permille[k] / 1000);
+    uint32_t seen = 0;
+    for (int i = 0; i < buckets; i++) {
+      seen += get32(p + 16 + i * 4);
+      if (seen > target) {
+        edges[k] = (uint32_t)(first + i + 1) << shift;
+        break;
+      }
+    }
+  }
+  printf("%10u histogram %-13s count=%u p50/p99/p99.9=%u/%u/%u worst=%u over=%u\n", time,
+         id < TELEMETRY_HISTOGRAMS ? histogramNames[id] : "?", count, edges[0], edges[1], edges[2], worst, overruns);
+}
+
+static void printTasks(Monitor& monitor, uint32_t time, const uint8_t* p, uint16_t length) {
+  if (length < 1 || length < 1 + p[0] * 20) {
+    monitor.broken++;
+    return;
+  }
+  printf("%10u tasks", time);
+  for (int i = 0; i < p[0]; i++) {
+    const uint8_t* t = p + 1 + i * 20;
+    uint32_t calls = get32(t);
+    uint32_t worked = get32(t + 4);
+    if (i < (int)TASK_NAMES) {
+      printf("  %s", taskNames[i]);
+    } else {
+      printf("  #%d", i);
+    }
+    printf("=%u/%u%% avg=%u worst=%u", calls, calls ? (unsigned)((uint64_t)worked * 100 / calls) : 0, get32(t + 8), get32(t + 12));
+    if (get32(t + 16)) {
+      printf(" deferred=%u", get32(t + 16));
+    }
+  }
+  printf("\n");
+}
+
+static void printTrace(Monitor& monitor, uint32_t time, const uint8_t* p, uint16_t length) {
+  if (length < 5 || length < 5 + p[4] * 12) {
+    monitor.broken++;
+    return;
+  }
+  uint32_t total = get32(p);
+  uint8_t count = p[4];
+  uint32_t lost = total - monitor.traceTotal - count;
+  monitor.traceTotal = total;
+  printf("%10u trace total=%u", time, total);
+  if (lost > 0 && lost <= total) {
+    printf(" lost=%u", lost);
+  }
+  printf("\n");
+  for (int i = 0; i < count; i++) {
+    const uint8_t* e = p + 5 + i * 12;
+    uint8_t event = e[4];
+    printf("%10u trace   %-12s work=%02x count=%u cycles=%u\n", get32(e),
+           event < TRACE_NAMES ? traceNames[event] : "?", e[5], get16(e + 6), get32(e + 8));
+  }
+}
+
+static void handleFrame(Monitor& monitor, const uint8_t* encoded, uint16_t length) {
+  uint8_t frame[TELEMETRY_MAX_FRAME];
+  if (length == 0) {
+    return;
+  }
+  uint16_t decoded = length <= TELEMETRY_MAX_FRAME ? telemetryDecode(encoded, length, frame) : 0;
+  if (decoded < 6) {
+    monitor.broken++;
+    return;
+  }
+  monitor.frames++;
+  uint8_t sequence = frame[1];
+  if (monitor.haveSequence && sequence != monitor.nextSequence) {
+    monitor.missing += (uint8_t)(sequence - monitor.nextSequence);
+  }
+  monitor.haveSequence = true;
+  monitor.nextSequence = sequence + 1;
+  uint32_t time = get32(frame + 2);
+  switch (frame[0]) {
+    case TELEMETRY_VOICES:
+      printVoices(monitor, time, frame + 6, decoded - 6);
+      break;
+    case TELEMETRY_COUNTERS:
+      printCounters(monitor, time, frame + 6, decoded - 6);
+      break;
+    case TELEMETRY_HISTOGRAM:
+      printHistogram(monitor, time, frame + 6, decoded - 6);
+      break;
+    case TELEMETRY_TASKS:
+      printTasks(monitor, time, frame + 6, decoded - 6);
+      break;
+    case TELEMETRY_TRACE:
+      printTrace(monitor, time, frame + 6, decoded - 6);
+      break;
+    default:
+      break;
+  }
+  fflush(stdout);
+}
+
+// ------------------------ Input
+static bool makeRaw(int fd) {
+  struct termios tio;
+  if (tcgetattr(fd, &tio) != 0) {
+    return false;
+  }
+  cfmakeraw(&tio);
+  tio.c_cc[VMIN] = 1;
+  tio.c_cc[VTIME] = 0;
+  return tcsetattr(fd, TCSANOW, &tio) == 0;
+}
+
+int main(int argc, char** argv) {
+  const char* input = 0;
+  const char* capturePath = 0;
+  Monitor monitor;
+  memset(&monitor, 0, sizeof(monitor));
+  monitor.voiceEvery = 1;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+      capturePath = argv[++i];
+    } else if (strcmp(argv[i], "--voices") == 0 && i + 1 < argc) {
+      monitor.voiceEvery = atoi(argv[++i]);
+      if (monitor.voiceEvery == 0) {
+        monitor.voiceEvery = 1;
+      }
+    } else if (input == 0) {
+      input = argv[i];
+    } else {
+      input = 0;
+      break;
+    }
+  }
+  if (input == 0) {
+    fprintf(stderr, "usage: telemetry_monitor <tty or capture> [--capture out.bin] [--voices n]\n");
+    return 2;
+  }
+
+  int fd = open(input, O_RDONLY | O_NOCTTY);
+  if (fd < 0) {
+    fprintf(stderr, "telemetry_monitor: can't open %s\n", input);
+    return 1;
+  }
+  struct stat info;
+  if (fstat(fd, &info) == 0 && S_ISCHR(info.st_mode) && !makeRaw(fd)) {
+    fprintf(stderr, "telemetry_monitor: can't set %s to raw mode\n", input);
+    return 1;
+  }
+  FILE* capture = 0;
+  if (capturePath != 0) {
+    capture = fopen(capturePath, "ab");
+    if (capture == 0) {
+      fprintf(stderr, "telemetry_monitor: can't write %s\n", capturePath);
+      return 1;
+    }
+  }
+
+  // Split on the delimiter; anything longer than a frame is skipped up to
+  // the next one, so text on the port or a partial first frame is harmless
+  uint8_t buffer[4096];
+  uint8_t pending[TELEMETRY_MAX_FRAME];
+  uint16_t pendingLength = 0;
+  bool overflow = false;
+  ssize_t got;
+  while ((got = read(fd, buffer, sizeof(buffer))) > 0) {
+    if (capture != 0) {
+      fwrite(buffer, 1, got, capture);
+      fflush(capture);
+    }
+    for (ssize_t i = 0; i < got; i++) {
+      if (buffer[i] == 0) {
+        if (overflow) {
+          monitor.broken++;
+        } else {
+          handleFrame(monitor, pending, pendingLength);
+        }
+        pendingLength = 0;
+        overflow = false;
+      } else if (pendingLength < sizeof(pending)) {
+        pending[pendingLength++] = buffer[i];
+      } else {
+        overflow = true;
+      }
+    }
+  }
+  if (capture != 0) {
+    fclose(capture);
+  }
+  close(fd);
+  fprintf(stderr, "%u frames, %u broken, %u missing\n", monitor.frames, monitor.broken, monitor.missing);
+  return 0;
+}
@@ -0,0 +1,187 @@
+// Voice engine cost at 8, 16, 32 and 64 voices, on the host: the firmware's
+// own VoiceEngineT (src/VoiceEngine.cpp) fed random events, and the per-tick
+// path into a routed output of two recording backends.
+//
+//   g++ -std=c++14 -O2 -Iinclude tools/voice_bench.cpp src/VoiceEngine.cpp src/Settings.cpp src/Tuning.cpp -o voice_bench
+//   ./voice_bench [--events n] [--ticks n] [--seed n]
+//
+// Per voice count, nanoseconds per call:
+//   on/off     note on and off on random keys, around half the voices
+//              sounding
+//   steal      note on with every voice sounding
+//   pressure   poly pressure to a sounding key
+//   sustain    pedal down and up with every voice sounding
+//   tick       smoothPressure() + glide() + render() + the frame through
+//              RoutedOutput, every voice sounding with pressure moving
+// Event costs should stay flat across the counts, the tick grows with them.
+// Host numbers only show the scaling; the device's own are in the firmware's
+// tick budget and task stats.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include "CvOutput.h"
+#include "Settings.h"
+#include "Tuning.h"
+#include "VoiceEngine.h"
+
+#define BENCH_EVENTS 2000000
+#define BENCH_TICKS 200000
+
+typedef std::chrono::steady_clock Clock;
+
+static TuningTable tuning;
+static uint32_t sink;
+static uint32_t random32 = 0x2545F491;
+
+static uint32_t nextRandom() {
+  random32 ^= random32 << 13;
+  random32 ^= random32 >> 17;
+  random32 ^= random32 << 5;
+  return random32;
+}
+
+static double nanoseconds(Clock::time_point start, uint32_t calls) {
+  return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / calls;
+}
+
+static MidiEvent makeEvent(uint8_t type, uint8_t data1, uint8_t data2) {
+  MidiEvent event;
+  event.time = 0;
+  event.source = 0;
+  event.type = type;
+  event.channel = 1;
+  event.data1 = data1;
+  event.data2 = data2;
+  return event;
+}
+
+template <uint8_t VOICES>
+static void bench(uint32_t events, uint32_t ticks) {
+  typedef VoiceEngineT<VOICES> Engine;
+  static CalibrationT<VOICES> calibration;
+  static Engine engine;
+  static RoutedOutput<SimOutput<VOICES>, SimOutput<VOICES>, VOICES> output;
+  static CvRoute route[VOICES];
+  calibrationDefaults(calibration);
+  for (int i = 0; i < VOICES; i++) {
+    // Alternate the backends, channels counted within each
+    route[i].output = i & 1 ? ROUTE_SECOND : ROUTE_FIRST;
+    route[i].channel = i / 2;
+  }
+  output.first.begin();
+  output.second.begin();
+  output.begin(route);
+  unsigned long now = 1;
+
+  // ------------------ Note on/off around half polyphony
+  std::vector<MidiEvent> stream(events);
+  uint8_t sounding[128] = { 0 };
+  unsigned count = 0;
+  for (uint32_t i = 0; i < events; i++) {
+    uint8_t key = 24 + nextRandom() % 80;
+    if (!sounding[key] && count < (unsigned)VOICES / 2) {
+      stream[i] = makeEvent(EVENT_TYPE_NOTE_ON, key, 100);
+      sounding[key] = 1;
+      count++;
+    } else {
+      // Release the key if it sounds, or any sounding one
+      while (!sounding[key]) {
+        key = 24 + (key - 24 + 1) % 80;
+      }
+      stream[i] = makeEvent(EVENT_TYPE_NOTE_OFF, key, 0);
+      sounding[key] = 0;
+      count--;
+    }
+  }
+  engine.begin(&patch, &calibration, &tuning);
+  Clock::time_point start = Clock::now();
+  for (uint32_t i = 0; i < events; i++) {
+    engine.handleEvent(stream[i], now++);
+  }
+  double noteNs = nanoseconds(start, events);
+
+  // ------------------ Steals, every voice sounding
+  engine.begin(&patch, &calibration, &tuning);
+  for (int i = 0; i < VOICES; i++) {
+    engine.noteOn(i, 100, now++);
+  }
+  start = Clock::now();
+  for (uint32_t i = 0; i < events; i++) {
+    engine.noteOn(i % 128, 100, now++);
+  }
+  double stealNs = nanoseconds(start, events);
+
+  // ------------------ Pressure and sustain on a full engine
+  engine.begin(&patch, &calibration, &tuning);
+  for (int i = 0; i < VOICES; i++) {
+    engine.noteOn(i, 100, now++);
+  }
+  start = Clock::now();
+  for (uint32_t i = 0; i < events; i++) {
+    engine.handleEvent(makeEvent(EVENT_TYPE_POLY_PRESSURE, i % VOICES, i & 0x7F), now);
+  }
+  double pressureNs = nanoseconds(start, events);
+  start = Clock::now();
+  for (uint32_t i = 0; i < events / 16; i++) {
+    engine.handleEvent(makeEvent(EVENT_TYPE_CONTROL_CHANGE, 64, 127), now);
+    engine.handleEvent(makeEvent(EVENT_TYPE_CONTROL_CHANGE, 64, 0), now);
+  }
+  double sustainNs = nanoseconds(start, events / 16 * 2);
+
+  // ------------------ Control ticks
+  engine.begin(&patch, &calibration, &tuning);
+  for (int i = 0; i < VOICES; i++) {
+    engine.noteOn(36 + i, 100, now++);
+  }
+  start = Clock::now();
+  for (uint32_t i = 0; i < ticks; i++) {
+    engine.voices[i % VOICES].pressureTarget = i & 0x7F;
+    engine.pitchBendFreq = (double)(i & 0xFF) / 128.0;
+    engine.smoothPressure();
+    engine.glide();
+    engine.render();
+    output.first.count = 0;
+    output.second.count = 0;
+    output.frame(engine.voices, VOICES, i);
+  }
+  double tickNs = nanoseconds(start, ticks);
+  sink += output.first.writes[0].volts + output.second.writes[0].volts;
+
+  printf("%6u %10.1f %10.1f %10.1f %10.1f %10.1f\n", VOICES, noteNs, stealNs, pressureNs, sustainNs, tickNs);
+}
+
+int main(int argc, char** argv) {
+  uint32_t events = BENCH_EVENTS;
+  uint32_t ticks = BENCH_TICKS;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--events") == 0 && i + 1 < argc) {
+      events = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--ticks") == 0 && i + 1 < argc) {
+      ticks = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      random32 = atoi(argv[++i]);
+      if (random32 == 0) {
+        random32 = 1;
+      }
+    } else {
+      fprintf(stderr, "usage: voice_bench [--events n] [--ticks n] [--seed n]\n");
+      return 2;
+    }
+  }
+  if (events < 16 || ticks < 1) {
+    fprintf(stderr, "voice_bench: need at least 16 events and 1 tick\n");
+    return 2;
+  }
+  patchDefaults();
+  tuningEqual(tuning);
+
+  printf("voices     on/off      steal   pressure    sustain       tick   (ns per call)\n");
+  bench<8>(events, ticks);
+  bench<16>(events, ticks);
+  bench<32>(events, ticks);
+  bench<64>(events, ticks);
+  return sink == 0xFFFFFFFF;
+}